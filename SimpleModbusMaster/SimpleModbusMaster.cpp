@@ -1,408 +1,1071 @@
-#include "SimpleModbusMaster.h"
-
-#define BUFFER_SIZE 128
-
-// modbus specific exceptions
-#define ILLEGAL_FUNCTION 1
-#define ILLEGAL_DATA_ADDRESS 2
-#define ILLEGAL_DATA_VALUE 3
-
-unsigned char transmission_ready_Flag;
-unsigned char messageOkFlag, messageErrFlag;
-unsigned char retry_count;
-unsigned char TxEnablePin;
-// frame[] is used to recieve and transmit packages.
-// The maximum number of bytes in a modbus packet is 256 bytes
-// This is limited to the serial buffer of 128 bytes
-unsigned char frame[BUFFER_SIZE];
-unsigned int timeout, polling;
-unsigned int T1_5; // inter character time out in microseconds
-unsigned int T3_5; // frame delay in microseconds
-unsigned long previousTimeout, previousPolling;
-unsigned int total_no_of_packets;
-Packet* packet; // current packet
-
-// function definitions
-void constructPacket();
-void checkResponse();
-void check_F3_data(unsigned char buffer);
-void check_F16_data();
-unsigned char getData();
-void check_packet_status();
-unsigned int calculateCRC(unsigned char bufferSize);
-void sendPacket(unsigned char bufferSize);
-
-
-unsigned int modbus_update(Packet* packets)
-{
-    // Initialize the connection_status variable to the
-    // total_no_of_packets. This value cannot be used as
-    // an index (and normally you won't). Returning this
-    // value to the main skecth informs the user that the
-    // previously scanned packet has no connection error.
-
-    unsigned int connection_status = total_no_of_packets;
-
-    if (transmission_ready_Flag) {
-
-        static unsigned int packet_index;
-
-        unsigned int failed_connections = 0;
-
-        unsigned char current_connection;
-
-        do {
-
-            if (packet_index == total_no_of_packets) // wrap around to the beginning
-                packet_index = 0;
-
-            // proceed to the next packet
-            packet = &packets[packet_index];
-
-            // get the current connection status
-            current_connection = packet->connection;
-
-            if (!current_connection) {
-                connection_status = packet_index;
-
-                // If all the connection attributes are false return
-                // immediately to the main sketch
-                if (++failed_connections == total_no_of_packets)
-                    return connection_status;
-            }
-
-            packet_index++;
-
-        } while (!current_connection); // while a packet has no connection get the next one
-
-        constructPacket();
-    }
-
-    checkResponse();
-
-    check_packet_status();
-
-    return connection_status;
-}
-
-void constructPacket()
-{
-    transmission_ready_Flag = 0; // disable the next transmission
-
-    packet->requests++;
-    frame[0] = packet->id;
-    frame[1] = packet->function;
-    frame[2] = packet->address >> 8; // address Hi
-    frame[3] = packet->address & 0xFF; // address Lo
-    frame[4] = packet->no_of_registers >> 8; // no_of_registers Hi
-    frame[5] = packet->no_of_registers & 0xFF; // no_of_registers Lo
-
-    unsigned int crc16;
-
-    // construct the frame according to the modbus function
-    if (packet->function == PRESET_MULTIPLE_REGISTERS) {
-        unsigned char no_of_bytes = packet->no_of_registers * 2;
-        unsigned char frameSize = 9 + no_of_bytes; // first 7 bytes of the array + 2 bytes CRC+ noOfBytes
-        frame[6] = no_of_bytes; // number of bytes
-        unsigned char index = 7; // user data starts at index 7
-        unsigned int temp;
-        unsigned char no_of_registers = packet->no_of_registers;
-        for (unsigned char i = 0; i < no_of_registers; i++) {
-            temp = packet->register_array[i]; // get the data
-            frame[index] = temp >> 8;
-            index++;
-            frame[index] = temp & 0xFF;
-            index++;
-        }
-        crc16 = calculateCRC(frameSize - 2);
-        frame[frameSize - 2] = crc16 >> 8; // split crc into 2 bytes
-        frame[frameSize - 1] = crc16 & 0xFF;
-        sendPacket(frameSize);
-
-        if (packet->id == 0) { // check broadcast id
-            messageOkFlag = 1; // message successful, there will be no response on a broadcast
-            previousPolling = millis(); // start the polling delay
-        }
-    } else { // READ_HOLDING_REGISTERS is assumed
-        crc16 = calculateCRC(6); // the first 6 bytes of the frame is used in the CRC calculation
-        frame[6] = crc16 >> 8; // crc Lo
-        frame[7] = crc16 & 0xFF; // crc Hi
-        sendPacket(8); // a request with function 3, 4 & 6 is always 8 bytes in size
-    }
-}
-
-void checkResponse()
-{
-    if (!messageOkFlag && !messageErrFlag) { // check for response
-        unsigned char buffer = getData();
-
-        if (buffer > 0) { // if there's something in the buffer continue
-            if (frame[0] == packet->id) { // check id returned
-                // to indicate an exception response a slave will 'OR'
-                // the requested function with 0x80
-                if ((frame[1] & 0x80) == 0x80) { // exctract 0x80
-                    // the third byte in the exception response packet is the actual exception
-                    switch (frame[2]) {
-                    case ILLEGAL_FUNCTION:
-                        packet->illegal_function++;
-                        break;
-                    case ILLEGAL_DATA_ADDRESS:
-                        packet->illegal_data_address++;
-                        break;
-                    case ILLEGAL_DATA_VALUE:
-                        packet->illegal_data_value++;
-                        break;
-                    default:
-                        packet->misc_exceptions++;
-                    }
-                    messageErrFlag = 1; // set an error
-                    previousPolling = millis(); // start the polling delay
-                } else { // the response is valid
-                    if (frame[1] == packet->function) { // check function number returned
-                        // receive the frame according to the modbus function
-                        if (packet->function == PRESET_MULTIPLE_REGISTERS)
-                            check_F16_data();
-                        else // READ_HOLDING_REGISTERS is assumed
-                            check_F3_data(buffer);
-                    } else { // incorrect function number returned
-                        packet->incorrect_function_returned++;
-                        messageErrFlag = 1; // set an error
-                        previousPolling = millis(); // start the polling delay
-                    }
-                } // check exception response
-            } else { // incorrect id returned
-                packet->incorrect_id_returned++;
-                messageErrFlag = 1; // set an error
-                previousPolling = millis(); // start the polling delay
-            }
-        } // check buffer
-    } // check message booleans
-}
-
-// checks the time out and polling delay and if a message has been recieved succesfully
-void check_packet_status()
-{
-    unsigned char pollingFinished = (millis() - previousPolling) > polling;
-
-    if (messageOkFlag && pollingFinished) { // if a valid message was recieved and the polling delay has expired clear the flag
-        messageOkFlag = 0;
-        packet->successful_requests++; // transaction sent successfully
-        packet->retries = 0; // if a request was successful reset the retry counter
-        transmission_ready_Flag = 1;
-    }
-
-    // if an error message was recieved and the polling delay has expired clear the flag
-    if (messageErrFlag && pollingFinished) {
-        messageErrFlag = 0; // clear error flag
-        packet->retries++;
-        transmission_ready_Flag = 1;
-    }
-
-    // if the timeout delay has past clear the slot number for next request
-    if (!transmission_ready_Flag && ((millis() - previousTimeout) > timeout)) {
-        packet->timeout++;
-        packet->retries++;
-        transmission_ready_Flag = 1;
-    }
-
-    // if the number of retries have reached the max number of retries
-    // allowable, stop requesting the specific packet
-    if (packet->retries == retry_count) {
-        packet->connection = 0;
-        packet->retries = 0;
-    }
-
-    if (transmission_ready_Flag) {
-        // update the total_errors atribute of the
-        // packet before requesting a new one
-        packet->total_errors = packet->timeout +
-                               packet->incorrect_id_returned +
-                               packet->incorrect_function_returned +
-                               packet->incorrect_bytes_returned +
-                               packet->checksum_failed +
-                               packet->buffer_errors +
-                               packet->illegal_function +
-                               packet->illegal_data_address +
-                               packet->illegal_data_value;
-    }
-}
-
-void check_F3_data(unsigned char buffer)
-{
-    unsigned char no_of_registers = packet->no_of_registers;
-    unsigned char no_of_bytes = no_of_registers * 2;
-    if (frame[2] == no_of_bytes) { // check number of bytes returned
-        // combine the crc Low & High bytes
-        unsigned int recieved_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]);
-        unsigned int calculated_crc = calculateCRC(buffer - 2);
-
-        if (calculated_crc == recieved_crc) { // verify checksum
-            unsigned char index = 3;
-            for (unsigned char i = 0; i < no_of_registers; i++) {
-                // start at the 4th element in the recieveFrame and combine the Lo byte
-                packet->register_array[i] = (frame[index] << 8) | frame[index + 1];
-                index += 2;
-            }
-            messageOkFlag = 1; // message successful
-        } else { // checksum failed
-            packet->checksum_failed++;
-            messageErrFlag = 1; // set an error
-        }
-
-        // start the polling delay for messageOkFlag & messageErrFlag
-        previousPolling = millis();
-    } else { // incorrect number of bytes returned
-        packet->incorrect_bytes_returned++;
-        messageErrFlag = 1; // set an error
-        previousPolling = millis(); // start the polling delay
-    }
-}
-
-void check_F16_data()
-{
-    unsigned int recieved_address = ((frame[2] << 8) | frame[3]);
-    unsigned int recieved_registers = ((frame[4] << 8) | frame[5]);
-    unsigned int recieved_crc = ((frame[6] << 8) | frame[7]); // combine the crc Low & High bytes
-    unsigned int calculated_crc = calculateCRC(6); // only the first 6 bytes are used for crc calculation
-
-    // check the whole packet
-    if (recieved_address == packet->address &&
-        recieved_registers == packet->no_of_registers &&
-        recieved_crc == calculated_crc)
-        messageOkFlag = 1; // message successful
-    else {
-        packet->checksum_failed++;
-        messageErrFlag = 1;
-    }
-
-    // start the polling delay for messageOkFlag & messageErrFlag
-    previousPolling = millis();
-}
-
-// get the serial data from the buffer
-unsigned char getData()
-{
-    unsigned char buffer = 0;
-    unsigned char overflowFlag = 0;
-
-    while (Serial.available()) {
-        // The maximum number of bytes is limited to the serial buffer size of 128 bytes
-        // If more bytes is received than the BUFFER_SIZE the overflow flag will be set and the
-        // serial buffer will be red untill all the data is cleared from the receive buffer,
-        // while the slave is still responding.
-        if (overflowFlag)
-            Serial.read();
-        else {
-            if (buffer == BUFFER_SIZE)
-                overflowFlag = 1;
-
-            frame[buffer] = Serial.read();
-            buffer++;
-        }
-
-        delayMicroseconds(T1_5); // inter character time out
-    }
-
-    // The minimum buffer size from a slave can be an exception response of 5 bytes
-    // If the buffer was partialy filled clear the buffer.
-    // The maximum number of bytes in a modbus packet is 256 bytes.
-    // The serial buffer limits this to 128 bytes.
-    // If the buffer overflows than clear the buffer and set
-    // a packet error.
-    if ((buffer > 0 && buffer < 5) || overflowFlag) {
-        buffer = 0;
-        packet->buffer_errors++;
-        messageErrFlag = 1; // set an error
-        previousPolling = millis(); // start the polling delay
-    }
-
-    return buffer;
-}
-
-void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling,
-                      unsigned char _retry_count, unsigned char _TxEnablePin,
-                      Packet* _packet, unsigned int _total_no_of_packets)
-{
-    Serial.begin(baud);
-
-    if (_TxEnablePin > 1) {
-        // pin 0 & pin 1 are reserved for RX/TX. To disable set _TxEnablePin < 2
-        TxEnablePin = _TxEnablePin;
-        pinMode(TxEnablePin, OUTPUT);
-        digitalWrite(TxEnablePin, LOW);
-    }
-
-    // Modbus states that a baud rate higher than 19200 must use a fixed 750 us
-    // for inter character time out and 1.75 ms for a frame delay.
-    // For baud rates below 19200 the timeing is more critical and has to be calculated.
-    // E.g. 9600 baud in a 10 bit packet is 960 characters per second
-    // In milliseconds this will be 960characters per 1000ms. So for 1 character
-    // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
-    // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
-    // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
-
-    if (baud > 19200) {
-        T1_5 = 750;
-        T3_5 = 1750;
-    } else {
-        T1_5 = 15000000/baud; // 1T * 1.5 = T1.5
-        T3_5 = 35000000/baud; // 1T * 3.5 = T3.5
-    }
-
-    // initialize connection status of each packet
-    for (unsigned char i = 0; i < _total_no_of_packets; i++) {
-        _packet->connection = 1;
-        _packet++;
-    }
-
-    // initialize
-    transmission_ready_Flag = 1;
-    messageOkFlag = 0;
-    messageErrFlag = 0;
-    timeout = _timeout;
-    polling = _polling;
-    retry_count = _retry_count;
-    TxEnablePin = _TxEnablePin;
-    total_no_of_packets = _total_no_of_packets;
-    previousTimeout = 0;
-    previousPolling = 0;
-}
-
-unsigned int calculateCRC(unsigned char bufferSize)
-{
-    unsigned int temp, temp2, flag;
-    temp = 0xFFFF;
-    for (unsigned char i = 0; i < bufferSize; i++) {
-        temp = temp ^ frame[i];
-        for (unsigned char j = 1; j <= 8; j++) {
-            flag = temp & 0x0001;
-            temp >>= 1;
-            if (flag)
-                temp ^= 0xA001;
-        }
-    }
-    // Reverse byte order.
-    temp2 = temp >> 8;
-    temp = (temp << 8) | temp2;
-    temp &= 0xFFFF;
-    return temp; // the returned value is already swopped - crcLo byte is first & crcHi byte is last
-}
-
-void sendPacket(unsigned char bufferSize)
-{
-    if (TxEnablePin > 1)
-        digitalWrite(TxEnablePin, HIGH);
-
-    for (unsigned char i = 0; i < bufferSize; i++)
-        Serial.write(frame[i]);
-
-    Serial.flush();
-
-    // allow a frame delay to indicate end of transmission
-    delayMicroseconds(T3_5);
-
-    if (TxEnablePin > 1)
-        digitalWrite(TxEnablePin, LOW);
-
-    previousTimeout = millis(); // initialize timeout delay
-}
\ No newline at end of file
+#include "SimpleModbusMaster.h"
+
+#define BUFFER_SIZE MODBUS_BUFFER_SIZE
+#define RX_POLL 20 // us between two looks for the next byte of a frame
+
+// immediate retries per scan of packets[] until modbus_configure_retries()
+#define DEFAULT_RETRY_BUDGET 4
+
+// modbus specific exceptions
+#define ILLEGAL_FUNCTION 1
+#define ILLEGAL_DATA_ADDRESS 2
+#define ILLEGAL_DATA_VALUE 3
+
+unsigned char transmission_ready_Flag;
+unsigned char messageOkFlag, messageErrFlag;
+unsigned char retry_count;
+unsigned char TxEnablePin;
+// frame[] is used to recieve and transmit packages.
+// The maximum number of bytes in a modbus packet is 256 bytes
+unsigned char frame[BUFFER_SIZE];
+unsigned int timeout, polling;
+unsigned int T1_5; // inter character time out in microseconds
+unsigned int T3_5; // frame delay in microseconds
+long baudRate;
+unsigned int portConfig = SERIAL_8N1; // data bits, parity and stop bits for Serial.begin()
+unsigned long previousTimeout, previousPolling;
+unsigned int retry_delay; // microseconds between an errored response and its retry
+unsigned char retryDelaySet; // retry_delay was given to modbus_configure_retries(), else it follows T3.5
+unsigned char retry_budget; // immediate retries allowed per scan of packets[]
+unsigned char retriesThisScan; // immediate retries used in the current scan
+unsigned char retryPending; // send the current packet again instead of the next one
+unsigned char messageException; // the errored response is an exception, see check_packet_status()
+unsigned long responseEnd; // micros() when the last response was handled
+unsigned long lineQuiet; // micros() when the last frame on the line, sent or received, ended
+unsigned int total_no_of_packets;
+Packet* packet; // current packet
+BusStats busStats;
+unsigned long* busPhase = &busStats.idle; // the busStats counter that is currently running, idle until modbus_configure()
+unsigned long busPhaseStart; // micros() when the current bus phase started
+
+#if MODBUS_QUEUE_SIZE
+typedef struct {
+    Packet* packet;
+    RequestCallback callback;
+    unsigned char urgent;
+} QueuedRequest;
+
+QueuedRequest requestQueue[MODBUS_QUEUE_SIZE]; // oldest first
+unsigned char queuedRequests; // number of requests in the queue
+unsigned char requestInProgress; // the packet on the line came from the queue
+unsigned char currentRequest; // its index in the queue
+unsigned char scanWrapped; // the scan of packets[] wrapped around, normal requests may go
+#endif
+
+// discovery sweep
+DiscoveryCallback discoveryCallback; // set while a sweep is running
+Packet probe; // the minimal request sent to every address
+unsigned int probeRegister;
+unsigned char lastProbeId;
+unsigned long probeSent; // micros() when the probe left the line
+unsigned long probeTimeout; // microseconds to wait for the first byte of an answer
+unsigned long probeGap; // micros() when the line went quiet after an answer
+unsigned char probeException; // exception code of the answer to the probe
+
+// listen only mode
+Stream* sniffPort; // set while sniffing
+unsigned char sniffFormat;
+unsigned int sniffBytes; // bytes of the frame on the line so far
+unsigned long sniffFrameStart; // micros() when its first byte was read
+unsigned long sniffLastByte; // micros() when its last byte was read
+unsigned char sniffAwaiting; // the last request expects a response
+unsigned char sniffId, sniffFunction; // of the last request
+
+#if MODBUS_ISR_RX
+// bytes taken by the receive interrupt, the serial ring buffer of
+// the core is too small for a long response when loop() is slow
+unsigned char rxRing[BUFFER_SIZE];
+volatile unsigned char rxHead; // next byte to write, written by the interrupt
+volatile unsigned char rxTail; // next byte to read
+
+unsigned char rxRead();
+
+#define SERIAL_AVAILABLE() (rxHead != rxTail)
+#define SERIAL_READ() rxRead()
+#else
+#define SERIAL_AVAILABLE() Serial.available()
+#define SERIAL_READ() Serial.read()
+#endif
+
+// function definitions
+void constructPacket();
+void checkResponse();
+void check_F3_data(unsigned int buffer);
+void check_F16_data();
+unsigned int getData();
+void check_packet_status();
+unsigned int calculateCRC(unsigned int bufferSize);
+void sendPacket(unsigned int bufferSize);
+void switchBusPhase(unsigned long* next);
+void beginPort(long baud);
+unsigned char takeQueuedRequest();
+void finishQueuedRequest(unsigned char ok);
+void requeueRequest();
+void discover();
+void sniff();
+void sniffFrame();
+void sniffHex(unsigned char value);
+
+// counts an event of the current packet at the MODBUS_STATISTICS level
+#if MODBUS_STATISTICS == MODBUS_STATS_FULL
+#define COUNT(counter) (packet->counter++)
+#elif MODBUS_STATISTICS == MODBUS_STATS_COMPACT
+#define COUNT(counter) do { if (packet->counter != 0xFF) packet->counter++; } while (0)
+#else
+#define COUNT(counter) ((void)0)
+#endif
+
+#if MODBUS_TRACE_DEPTH
+typedef struct {
+    unsigned long time; // micros() when the frame was handled
+    unsigned char info; // TRACE_TX | outcome
+    unsigned char length; // length of the frame on the line
+    unsigned char data[MODBUS_TRACE_BYTES];
+} TraceRecord;
+
+TraceRecord trace[MODBUS_TRACE_DEPTH];
+unsigned char traceNext; // slot of the next record
+unsigned char traceCount; // number of valid records
+
+void traceFrame(unsigned int length, unsigned char info);
+void traceOutcome(unsigned char info);
+
+#define TRACE_FRAME(length, info) traceFrame(length, info)
+#define TRACE_OUTCOME(info) traceOutcome(info)
+#else
+#define TRACE_FRAME(length, info) ((void)0)
+#define TRACE_OUTCOME(info) ((void)0)
+#endif
+
+
+unsigned int modbus_update(Packet* packets)
+{
+    // Initialize the connection_status variable to the
+    // total_no_of_packets. This value cannot be used as
+    // an index (and normally you won't). Returning this
+    // value to the main skecth informs the user that the
+    // previously scanned packet has no connection error.
+
+    unsigned int connection_status = total_no_of_packets;
+
+    if (sniffPort) {
+        sniff();
+        return connection_status;
+    }
+
+    // a discovery sweep has the line to itself once it is free
+    if (discoveryCallback && (transmission_ready_Flag || packet == &probe)) {
+        discover();
+        return connection_status;
+    }
+
+    if (transmission_ready_Flag) {
+
+        if (retryPending) {
+            retryPending = 0; // the same packet once more
+        } else if (!takeQueuedRequest()) { // queued requests go ahead of or between the scans
+
+            if (!total_no_of_packets)
+                return connection_status; // nothing to scan
+
+            static unsigned int packet_index;
+
+            unsigned int failed_connections = 0;
+
+            unsigned char current_connection;
+
+            do {
+
+                if (packet_index == total_no_of_packets) { // wrap around to the beginning
+                    packet_index = 0;
+                    retriesThisScan = 0;
+                }
+
+                // proceed to the next packet
+                packet = &packets[packet_index];
+
+                // get the current connection status
+                current_connection = packet->connection;
+
+                if (!current_connection) {
+                    connection_status = packet_index;
+
+                    // If all the connection attributes are false return
+                    // immediately to the main sketch
+                    if (++failed_connections == total_no_of_packets)
+                        return connection_status;
+                }
+
+                packet_index++;
+
+            } while (!current_connection); // while a packet has no connection get the next one
+
+#if MODBUS_QUEUE_SIZE
+            if (packet_index == total_no_of_packets)
+                scanWrapped = 1; // normal requests go before the next scan
+#endif
+        }
+
+        constructPacket();
+    }
+
+    checkResponse();
+
+    check_packet_status();
+
+    return connection_status;
+}
+
+void constructPacket()
+{
+    transmission_ready_Flag = 0; // disable the next transmission
+
+    COUNT(requests);
+    frame[0] = packet->id;
+    frame[1] = packet->function;
+    frame[2] = packet->address >> 8; // address Hi
+    frame[3] = packet->address & 0xFF; // address Lo
+    frame[4] = packet->no_of_registers >> 8; // no_of_registers Hi
+    frame[5] = packet->no_of_registers & 0xFF; // no_of_registers Lo
+
+    unsigned int crc16;
+
+    // construct the frame according to the modbus function
+    if (packet->function == PRESET_MULTIPLE_REGISTERS) {
+        unsigned int no_of_registers = packet->no_of_registers;
+        unsigned int frameSize = 9 + no_of_registers * 2; // first 7 bytes of the array + 2 bytes CRC+ noOfBytes
+        if (no_of_registers > 123 || frameSize > BUFFER_SIZE) {
+            // too long for a request or for frame[], it is never sent
+            COUNT(buffer_errors);
+            TRACE_FRAME(0, TRACE_BUFFER_ERROR);
+            messageErrFlag = 1;
+            previousPolling = millis();
+            responseEnd = micros();
+            switchBusPhase(&busStats.polling);
+            return;
+        }
+        frame[6] = no_of_registers * 2; // number of bytes
+        unsigned int index = 7; // user data starts at index 7
+        unsigned int temp;
+        for (unsigned int i = 0; i < no_of_registers; i++) {
+            temp = packet->register_array[i]; // get the data
+            frame[index] = temp >> 8;
+            index++;
+            frame[index] = temp & 0xFF;
+            index++;
+        }
+        crc16 = calculateCRC(frameSize - 2);
+        frame[frameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+        frame[frameSize - 1] = crc16 & 0xFF;
+        sendPacket(frameSize);
+
+        if (packet->id == 0) { // check broadcast id
+            messageOkFlag = 1; // message successful, there will be no response on a broadcast
+            previousPolling = millis(); // start the polling delay
+            switchBusPhase(&busStats.polling);
+        }
+    } else { // READ_HOLDING_REGISTERS is assumed
+        crc16 = calculateCRC(6); // the first 6 bytes of the frame is used in the CRC calculation
+        frame[6] = crc16 >> 8; // crc Lo
+        frame[7] = crc16 & 0xFF; // crc Hi
+        sendPacket(8); // a request with function 3, 4 & 6 is always 8 bytes in size
+    }
+}
+
+void checkResponse()
+{
+    if (!messageOkFlag && !messageErrFlag) { // check for response
+        unsigned int buffer = getData();
+
+        if (buffer > 0) { // if there's something in the buffer continue
+            if (frame[0] == packet->id) { // check id returned
+                // to indicate an exception response a slave will 'OR'
+                // the requested function with 0x80
+                if ((frame[1] & 0x80) == 0x80) { // exctract 0x80
+                    // the third byte in the exception response packet is the actual exception
+                    switch (frame[2]) {
+                    case ILLEGAL_FUNCTION:
+                        COUNT(illegal_function);
+                        break;
+                    case ILLEGAL_DATA_ADDRESS:
+                        COUNT(illegal_data_address);
+                        break;
+                    case ILLEGAL_DATA_VALUE:
+                        COUNT(illegal_data_value);
+                        break;
+                    default:
+                        COUNT(misc_exceptions);
+                    }
+                    TRACE_OUTCOME(TRACE_EXCEPTION);
+                    probeException = frame[2]; // the discovery sweep reports it
+                    messageException = 1;
+                    messageErrFlag = 1; // set an error
+                    previousPolling = millis(); // start the polling delay
+                } else { // the response is valid
+                    if (frame[1] == packet->function) { // check function number returned
+                        // receive the frame according to the modbus function
+                        if (packet->function == PRESET_MULTIPLE_REGISTERS)
+                            check_F16_data();
+                        else // READ_HOLDING_REGISTERS is assumed
+                            check_F3_data(buffer);
+                    } else { // incorrect function number returned
+                        COUNT(incorrect_function_returned);
+                        TRACE_OUTCOME(TRACE_INCORRECT_FUNCTION);
+                        messageErrFlag = 1; // set an error
+                        previousPolling = millis(); // start the polling delay
+                    }
+                } // check exception response
+            } else { // incorrect id returned
+                COUNT(incorrect_id_returned);
+                TRACE_OUTCOME(TRACE_INCORRECT_ID);
+                messageErrFlag = 1; // set an error
+                previousPolling = millis(); // start the polling delay
+            }
+        } // check buffer
+
+        // the response has been handled, the rest is polling delay
+        if (messageOkFlag || messageErrFlag) {
+            responseEnd = micros();
+            switchBusPhase(&busStats.polling);
+        }
+    } // check message booleans
+}
+
+// checks the time out and polling delay and if a message has been recieved succesfully
+void check_packet_status()
+{
+    unsigned char pollingFinished = (millis() - previousPolling) > polling;
+
+    if (messageOkFlag && pollingFinished) { // if a valid message was recieved and the polling delay has expired clear the flag
+        messageOkFlag = 0;
+        COUNT(successful_requests); // transaction sent successfully
+        packet->retries = 0; // if a request was successful reset the retry counter
+        transmission_ready_Flag = 1;
+        switchBusPhase(&busStats.idle);
+    }
+
+    // A garbled response (checksum, buffer, id, function or byte count)
+    // is most likely noise on the line, so the same packet is sent again
+    // after only the retry delay while the scan has retry budget left.
+    // An exception is the slave's deliberate answer and would only come
+    // again, so like the rest without budget, or on the last retry, it
+    // waits out the polling delay.
+    if (messageErrFlag) {
+        unsigned char retryNow = !messageException && packet->retries + 1 < retry_count &&
+                                 (retriesThisScan < retry_budget || !total_no_of_packets);
+
+        if (retryNow ? (micros() - responseEnd) >= retry_delay : pollingFinished) {
+            messageErrFlag = 0; // clear error flag
+            messageException = 0;
+            COUNT(total_errors);
+            busStats.errors++;
+            packet->retries++;
+            transmission_ready_Flag = 1;
+            if (retryNow) {
+                retriesThisScan++;
+                retryPending = 1;
+            }
+            switchBusPhase(&busStats.idle);
+        }
+    }
+
+    // if the timeout delay has past clear the slot number for next request,
+    // a response that has already been handled is only waiting for its delay
+    if (!transmission_ready_Flag && !messageOkFlag && !messageErrFlag &&
+        ((millis() - previousTimeout) > timeout)) {
+        COUNT(timeout);
+        COUNT(total_errors);
+        busStats.errors++;
+        packet->retries++;
+        TRACE_FRAME(0, TRACE_TIMEOUT);
+        transmission_ready_Flag = 1;
+        // the time spent waiting for this response was lost to the timeout
+        if (busPhase == &busStats.turnaround)
+            busPhase = &busStats.timeout;
+        switchBusPhase(&busStats.idle);
+    }
+
+#if MODBUS_QUEUE_SIZE
+    // a queued request leaves the queue once it succeeded or ran out of retries
+    if (transmission_ready_Flag && requestInProgress &&
+        (!packet->retries || packet->retries >= retry_count)) {
+        unsigned char ok = !packet->retries;
+        packet->retries = 0;
+        finishQueuedRequest(ok);
+    }
+#endif
+
+    // if the number of retries have reached the max number of retries
+    // allowable, stop requesting the specific packet
+    if (packet->retries == retry_count) {
+        packet->connection = 0;
+        packet->retries = 0;
+    }
+}
+
+void check_F3_data(unsigned int buffer)
+{
+    unsigned int no_of_registers = packet->no_of_registers;
+    unsigned int no_of_bytes = no_of_registers * 2;
+    if (frame[2] == no_of_bytes && buffer == 5 + no_of_bytes) { // check number of bytes returned
+        // combine the crc Low & High bytes
+        unsigned int recieved_crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]);
+        unsigned int calculated_crc = calculateCRC(buffer - 2);
+
+        if (calculated_crc == recieved_crc) { // verify checksum
+            unsigned int index = 3;
+            for (unsigned int i = 0; i < no_of_registers; i++) {
+                // start at the 4th element in the recieveFrame and combine the Lo byte
+                packet->register_array[i] = (frame[index] << 8) | frame[index + 1];
+                index += 2;
+            }
+            messageOkFlag = 1; // message successful
+        } else { // checksum failed
+            COUNT(checksum_failed);
+            TRACE_OUTCOME(TRACE_CHECKSUM_FAILED);
+            messageErrFlag = 1; // set an error
+        }
+
+        // start the polling delay for messageOkFlag & messageErrFlag
+        previousPolling = millis();
+    } else { // incorrect number of bytes returned
+        COUNT(incorrect_bytes_returned);
+        TRACE_OUTCOME(TRACE_INCORRECT_BYTES);
+        messageErrFlag = 1; // set an error
+        previousPolling = millis(); // start the polling delay
+    }
+}
+
+void check_F16_data()
+{
+    unsigned int recieved_address = ((frame[2] << 8) | frame[3]);
+    unsigned int recieved_registers = ((frame[4] << 8) | frame[5]);
+    unsigned int recieved_crc = ((frame[6] << 8) | frame[7]); // combine the crc Low & High bytes
+    unsigned int calculated_crc = calculateCRC(6); // only the first 6 bytes are used for crc calculation
+
+    // check the whole packet
+    if (recieved_address == packet->address &&
+        recieved_registers == packet->no_of_registers &&
+        recieved_crc == calculated_crc)
+        messageOkFlag = 1; // message successful
+    else {
+        COUNT(checksum_failed);
+        TRACE_OUTCOME(TRACE_CHECKSUM_FAILED);
+        messageErrFlag = 1;
+    }
+
+    // start the polling delay for messageOkFlag & messageErrFlag
+    previousPolling = millis();
+}
+
+// get the serial data from the buffer
+unsigned int getData()
+{
+    unsigned int buffer = 0;
+    unsigned char overflowFlag = 0;
+
+    if (SERIAL_AVAILABLE())
+        switchBusPhase(&busStats.receive); // the first byte of the response has arrived
+
+    while (SERIAL_AVAILABLE()) {
+        // The maximum number of bytes is limited to BUFFER_SIZE.
+        // If more bytes is received than the BUFFER_SIZE the overflow flag will be set and the
+        // serial buffer will be red untill all the data is cleared from the receive buffer,
+        // while the slave is still responding.
+        if (overflowFlag || buffer == BUFFER_SIZE) {
+            overflowFlag = 1;
+            SERIAL_READ();
+        } else {
+            frame[buffer] = SERIAL_READ();
+            buffer++;
+        }
+
+        // Wait for the next byte up to the inter character time out. It
+        // is read as soon as it arrives rather than one byte per T1.5,
+        // so the serial buffer doesn't fill up during a long frame.
+        lineQuiet = micros();
+        while (!SERIAL_AVAILABLE() && (micros() - lineQuiet) <= T1_5)
+            delayMicroseconds(RX_POLL);
+    }
+
+    if (buffer > 0)
+        TRACE_FRAME(buffer, TRACE_OK);
+
+    // The minimum buffer size from a slave can be an exception response of 5 bytes
+    // If the buffer was partialy filled clear the buffer.
+    // The maximum number of bytes in a modbus packet is 256 bytes.
+    // If the buffer overflows than clear the buffer and set
+    // a packet error.
+    if ((buffer > 0 && buffer < 5) || overflowFlag) {
+        buffer = 0;
+        COUNT(buffer_errors);
+        TRACE_OUTCOME(TRACE_BUFFER_ERROR);
+        messageErrFlag = 1; // set an error
+        previousPolling = millis(); // start the polling delay
+    }
+
+    return buffer;
+}
+
+void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling,
+                      unsigned char _retry_count, unsigned char _TxEnablePin,
+                      Packet* _packet, unsigned int _total_no_of_packets)
+{
+    beginPort(baud);
+
+    if (_TxEnablePin > 1) {
+        // pin 0 & pin 1 are reserved for RX/TX. To disable set _TxEnablePin < 2
+        TxEnablePin = _TxEnablePin;
+        pinMode(TxEnablePin, OUTPUT);
+        digitalWrite(TxEnablePin, LOW);
+    }
+
+    retryDelaySet = 0;
+    modbus_configure_timing(TIMING_SPEC, 10, 0, 0); // 8N1
+
+    // initialize connection status of each packet
+    for (unsigned int i = 0; i < _total_no_of_packets; i++) {
+        _packet->connection = 1;
+        _packet++;
+    }
+
+    // initialize
+    transmission_ready_Flag = 1;
+    messageOkFlag = 0;
+    messageErrFlag = 0;
+    messageException = 0;
+    timeout = _timeout;
+    polling = _polling;
+    retry_count = _retry_count;
+    retry_budget = DEFAULT_RETRY_BUDGET;
+    retriesThisScan = 0;
+    retryPending = 0;
+    TxEnablePin = _TxEnablePin;
+    total_no_of_packets = _total_no_of_packets;
+#if MODBUS_QUEUE_SIZE
+    queuedRequests = 0;
+    requestInProgress = 0;
+    scanWrapped = 0;
+#endif
+    previousTimeout = 0;
+    previousPolling = 0;
+    modbus_clear_bus_stats();
+}
+
+void modbus_configure_timing(unsigned char profile, unsigned char bitsPerChar, unsigned int t1_5, unsigned int t3_5)
+{
+    if (!baudRate || !bitsPerChar)
+        return; // before modbus_configure(), which sets the timing itself
+
+    // Modbus states that a baud rate higher than 19200 must use a fixed 750 us
+    // for inter character time out and 1.75 ms for a frame delay.
+    // For baud rates below 19200 the timeing is more critical and has to be calculated.
+    // E.g. 9600 baud in a 10 bit character (8N1) is 960 characters per second
+    // In milliseconds this will be 960characters per 1000ms. So for 1 character
+    // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
+    // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
+    // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
+    // An 11 bit character (8E1 or 8N2) takes 1.1 times as long.
+    if (profile == TIMING_CUSTOM) {
+        T1_5 = t1_5;
+        T3_5 = t3_5;
+    } else if (profile == TIMING_SPEC && baudRate > 19200) {
+        T1_5 = 750;
+        T3_5 = 1750;
+    } else {
+        unsigned long charTime15 = bitsPerChar * 1500000UL / baudRate; // 1T * 1.5 = T1.5
+        unsigned long charTime35 = bitsPerChar * 3500000UL / baudRate; // 1T * 3.5 = T3.5
+        T1_5 = charTime15 < 0xFFFF ? charTime15 : 0xFFFF;
+        T3_5 = charTime35 < 0xFFFF ? charTime35 : 0xFFFF;
+    }
+
+    if (!retryDelaySet)
+        retry_delay = T3_5;
+}
+
+void modbus_configure_port(unsigned int config)
+{
+    portConfig = config;
+    if (baudRate)
+        beginPort(baudRate);
+}
+
+void beginPort(long baud)
+{
+    baudRate = baud;
+#if MODBUS_ISR_RX && defined(__AVR__)
+    // USART0 is driven here and not through Serial, whose interrupt
+    // would clash with the one below, at double speed like the core.
+    // The core's SERIAL_8N1 etc. are the bits of UCSR0C.
+    UCSR0A = _BV(U2X0);
+    UBRR0 = (F_CPU / 4 / baud - 1) / 2;
+    UCSR0C = portConfig;
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+#else
+    Serial.begin(baud, portConfig);
+#endif
+}
+
+void modbus_bus_stats(BusStats* stats)
+{
+    switchBusPhase(busPhase); // account the running phase up to now
+    *stats = busStats;
+}
+
+void modbus_clear_bus_stats()
+{
+    memset(&busStats, 0, sizeof(busStats));
+    busPhase = &busStats.idle;
+    busPhaseStart = micros();
+}
+
+// account the time since the last switch to the running phase and start the next one
+void switchBusPhase(unsigned long* next)
+{
+    unsigned long now = micros();
+    *busPhase += now - busPhaseStart;
+    busPhase = next;
+    busPhaseStart = now;
+}
+
+unsigned int calculateCRC(unsigned int bufferSize)
+{
+    unsigned int temp, temp2, flag;
+    temp = 0xFFFF;
+    for (unsigned int i = 0; i < bufferSize; i++) {
+        temp = temp ^ frame[i];
+        for (unsigned char j = 1; j <= 8; j++) {
+            flag = temp & 0x0001;
+            temp >>= 1;
+            if (flag)
+                temp ^= 0xA001;
+        }
+    }
+    // Reverse byte order.
+    temp2 = temp >> 8;
+    temp = (temp << 8) | temp2;
+    temp &= 0xFFFF;
+    return temp; // the returned value is already swopped - crcLo byte is first & crcHi byte is last
+}
+
+void sendPacket(unsigned int bufferSize)
+{
+    // A frame starts after T3.5 of silence. The wait is here and not
+    // after the request, where the response may already be arriving
+    // and would overflow the serial buffer before getData() reads it.
+    unsigned long quiet = micros() - lineQuiet;
+    if (quiet < T3_5)
+        delayMicroseconds(T3_5 - quiet);
+
+    switchBusPhase(&busStats.transmit);
+    TRACE_FRAME(bufferSize, TRACE_TX);
+
+    if (TxEnablePin > 1)
+        digitalWrite(TxEnablePin, HIGH);
+
+#if MODBUS_ISR_RX && defined(__AVR__)
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0); // clear the transmit complete flag
+    for (unsigned int i = 0; i < bufferSize; i++) {
+        while (!(UCSR0A & _BV(UDRE0)))
+            ;
+        UDR0 = frame[i];
+    }
+
+    while (!(UCSR0A & _BV(TXC0)))
+        ; // the last stop bit is out
+#else
+    for (unsigned int i = 0; i < bufferSize; i++)
+        Serial.write(frame[i]);
+
+    Serial.flush();
+#endif
+    lineQuiet = micros();
+
+    if (TxEnablePin > 1)
+        digitalWrite(TxEnablePin, LOW);
+
+    previousTimeout = millis(); // initialize timeout delay
+    switchBusPhase(&busStats.turnaround);
+}
+
+void modbus_discover(unsigned char first_id, unsigned char last_id, DiscoveryCallback callback)
+{
+    if (!first_id)
+        first_id = 1; // nobody answers a broadcast
+    if (last_id > 247)
+        last_id = 247;
+
+    probe.id = first_id;
+    probe.function = READ_HOLDING_REGISTERS;
+    probe.address = 0;
+    probe.no_of_registers = 1;
+    probe.register_array = &probeRegister;
+    lastProbeId = last_id;
+    probeTimeout = (unsigned long)MODBUS_DISCOVERY_T35 * T3_5;
+    probeGap = micros() - T3_5;
+    discoveryCallback = first_id <= last_id ? callback : 0;
+}
+
+unsigned char modbus_discovering()
+{
+    return discoveryCallback != 0;
+}
+
+// one step of the sweep, called by modbus_update() instead of the scan
+void discover()
+{
+    if (transmission_ready_Flag) {
+        if (probe.id > lastProbeId || probe.id == 0) { // done, 0 after 255 wrapped
+            discoveryCallback = 0;
+            return;
+        }
+        // a late answer to a probe that timed out is dropped, and the
+        // next probe waits for the frame delay after it
+        while (SERIAL_AVAILABLE()) {
+            SERIAL_READ();
+            probeGap = micros();
+        }
+        if ((micros() - probeGap) < T3_5)
+            return; // the answer to the last probe needs its frame delay
+
+        retryPending = 0; // the scan starts over when the sweep is done
+        requeueRequest();
+        packet = &probe;
+        probeException = 0;
+        constructPacket();
+        probeSent = lineQuiet; // the end of the probe, the turnaround starts there
+        return;
+    }
+
+    if (SERIAL_AVAILABLE()) {
+        unsigned long turnaround = micros() - probeSent;
+
+        checkResponse(); // reads the whole answer
+
+        if (frame[0] != probe.id) {
+            // late from an earlier id, this one may still answer
+            messageOkFlag = 0;
+            messageErrFlag = 0;
+            messageException = 0;
+            switchBusPhase(&busStats.turnaround);
+            return;
+        }
+
+        unsigned char exception;
+        if (messageOkFlag)
+            exception = 0;
+        else if (probeException)
+            exception = probeException;
+        else
+            exception = DISCOVERY_GARBLED;
+
+        // give slower slaves the same margin as the slowest one seen
+        if (2 * turnaround + T3_5 > probeTimeout)
+            probeTimeout = 2 * turnaround + T3_5;
+
+        messageOkFlag = 0;
+        messageErrFlag = 0;
+        messageException = 0;
+        probeGap = micros();
+        transmission_ready_Flag = 1;
+        switchBusPhase(&busStats.idle);
+        discoveryCallback(probe.id, exception, turnaround);
+        probe.id++;
+    } else if ((micros() - probeSent) > probeTimeout) { // nobody there
+        probeGap = micros() - T3_5; // the line has been quiet all along
+        transmission_ready_Flag = 1;
+        if (busPhase == &busStats.turnaround)
+            busPhase = &busStats.timeout;
+        switchBusPhase(&busStats.idle);
+        probe.id++;
+    }
+}
+
+void modbus_configure_retries(unsigned int _retry_delay, unsigned char _retry_budget)
+{
+    retry_delay = _retry_delay;
+    retryDelaySet = 1;
+    retry_budget = _retry_budget;
+}
+
+unsigned char modbus_request(Packet* _packet, RequestCallback callback, unsigned char urgent)
+{
+#if MODBUS_QUEUE_SIZE
+    if (queuedRequests == MODBUS_QUEUE_SIZE)
+        return 0; // full
+
+    _packet->retries = 0;
+    _packet->connection = 1;
+    requestQueue[queuedRequests].packet = _packet;
+    requestQueue[queuedRequests].callback = callback;
+    requestQueue[queuedRequests].urgent = urgent;
+    queuedRequests++;
+    return 1;
+#else
+    (void)_packet;
+    (void)callback;
+    (void)urgent;
+    return 0;
+#endif
+}
+
+// picks the next queued request, urgent ones first and the
+// others only when the scan has wrapped around
+unsigned char takeQueuedRequest()
+{
+#if MODBUS_QUEUE_SIZE
+    unsigned char next = queuedRequests;
+
+    for (unsigned char i = 0; i < queuedRequests; i++) {
+        if (requestQueue[i].urgent) {
+            next = i;
+            break;
+        }
+    }
+
+    if (next == queuedRequests && queuedRequests && (scanWrapped || !total_no_of_packets))
+        next = 0;
+
+    if (next == queuedRequests) {
+        scanWrapped = 0; // nothing left for this gap, the scan goes on
+        return 0;
+    }
+
+    packet = requestQueue[next].packet;
+    currentRequest = next;
+    requestInProgress = 1;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void finishQueuedRequest(unsigned char ok)
+{
+#if MODBUS_QUEUE_SIZE
+    QueuedRequest request = requestQueue[currentRequest];
+
+    queuedRequests--;
+    for (unsigned char i = currentRequest; i < queuedRequests; i++)
+        requestQueue[i] = requestQueue[i + 1];
+    requestInProgress = 0;
+
+    // the queue has room again when the callback runs
+    if (request.callback)
+        request.callback(request.packet, ok);
+#else
+    (void)ok;
+#endif
+}
+
+// a queued request cut short by a sweep or by sniffing stays in the
+// queue and is sent again from the start later
+void requeueRequest()
+{
+#if MODBUS_QUEUE_SIZE
+    if (requestInProgress) {
+        packet->retries = 0;
+        requestInProgress = 0;
+    }
+#endif
+}
+
+void modbus_sniff(Stream* port, unsigned char format)
+{
+    // whatever was going on is dropped, the master starts over afterwards
+    transmission_ready_Flag = 1;
+    messageOkFlag = 0;
+    messageErrFlag = 0;
+    messageException = 0;
+    retryPending = 0;
+    requeueRequest();
+    switchBusPhase(&busStats.idle);
+
+    sniffPort = port;
+    sniffFormat = format;
+    sniffBytes = 0;
+    sniffAwaiting = 0;
+}
+
+// splits what is on the line into frames at the T3.5 gaps
+void sniff()
+{
+    while (SERIAL_AVAILABLE()) {
+        unsigned char c = SERIAL_READ();
+        sniffLastByte = micros();
+
+        if (!sniffBytes)
+            sniffFrameStart = sniffLastByte;
+        if (sniffBytes < BUFFER_SIZE)
+            frame[sniffBytes] = c;
+        if (sniffBytes <= BUFFER_SIZE)
+            sniffBytes++; // one past BUFFER_SIZE marks an overflow
+    }
+
+    if (sniffBytes && (micros() - sniffLastByte) > T3_5) {
+        sniffFrame();
+        sniffBytes = 0;
+    }
+}
+
+void sniffFrame()
+{
+    unsigned int length = sniffBytes > BUFFER_SIZE ? BUFFER_SIZE : sniffBytes;
+    unsigned char info = 0;
+
+    if (sniffBytes > BUFFER_SIZE)
+        info |= SNIFF_OVERFLOW;
+    else if (length < 4)
+        info |= SNIFF_CHECKSUM_FAILED;
+    else {
+        unsigned int recieved_crc = ((frame[length - 2] << 8) | frame[length - 1]);
+        if (calculateCRC(length - 2) != recieved_crc)
+            info |= SNIFF_CHECKSUM_FAILED;
+    }
+
+    // A frame from the slave that was asked last, shaped like a
+    // response to the function asked for, is its response. Anything
+    // else is taken for a request. Only an intact request to a
+    // slave (not a broadcast) gets a response.
+    // Below 3 bytes frame[1] and frame[2] are left from an earlier
+    // frame, such a frame is never a response.
+    unsigned int responseLength = 0;
+    if (length >= 3) {
+        if (frame[1] & 0x80)
+            responseLength = 5; // exception
+        else if (frame[1] == 3 || frame[1] == 4)
+            responseLength = 5 + frame[2]; // byte count
+        else
+            responseLength = 8; // echo of address and quantity or value
+    }
+    if (sniffAwaiting && length == responseLength && frame[0] == sniffId && (frame[1] & 0x7F) == sniffFunction) {
+        info |= SNIFF_RESPONSE;
+        sniffAwaiting = 0;
+    } else {
+        sniffAwaiting = !info && frame[0] != 0; // info is set below 4 bytes
+        sniffId = frame[0];
+        sniffFunction = frame[1];
+    }
+
+    if (sniffFormat == SNIFF_TEXT) {
+        // 0012d687 > 01 03 00 00 00 01 84 0a
+        sniffHex(sniffFrameStart >> 24);
+        sniffHex(sniffFrameStart >> 16);
+        sniffHex(sniffFrameStart >> 8);
+        sniffHex(sniffFrameStart);
+        sniffPort->write(info & SNIFF_RESPONSE ? " <" : " >");
+        for (unsigned int i = 0; i < length; i++) {
+            sniffPort->write(' ');
+            sniffHex(frame[i]);
+        }
+        if (info & SNIFF_CHECKSUM_FAILED)
+            sniffPort->write(" crc");
+        if (info & SNIFF_OVERFLOW)
+            sniffPort->write(" overflow");
+        sniffPort->write('\n');
+    } else {
+        // the layout of a modbus_trace_dump() record
+        sniffPort->write((unsigned char)(sniffFrameStart >> 24));
+        sniffPort->write((unsigned char)(sniffFrameStart >> 16));
+        sniffPort->write((unsigned char)(sniffFrameStart >> 8));
+        sniffPort->write((unsigned char)sniffFrameStart);
+        sniffPort->write(info);
+        if (length > 255)
+            length = 255; // what the length byte holds
+        sniffPort->write(length);
+        sniffPort->write(frame, length);
+    }
+}
+
+void sniffHex(unsigned char value)
+{
+    static const char digits[] = "0123456789abcdef";
+    sniffPort->write(digits[value >> 4]);
+    sniffPort->write(digits[value & 0x0F]);
+}
+
+void modbus_trace_dump(Stream* port)
+{
+#if MODBUS_TRACE_DEPTH
+    // start with the oldest record
+    unsigned char index = (traceNext + MODBUS_TRACE_DEPTH - traceCount) % MODBUS_TRACE_DEPTH;
+
+    port->write(traceCount);
+    for (unsigned char i = 0; i < traceCount; i++) {
+        TraceRecord* record = &trace[index];
+        unsigned char dataSize = record->length < MODBUS_TRACE_BYTES ? record->length : MODBUS_TRACE_BYTES;
+        port->write((unsigned char)(record->time >> 24));
+        port->write((unsigned char)(record->time >> 16));
+        port->write((unsigned char)(record->time >> 8));
+        port->write((unsigned char)record->time);
+        port->write(record->info);
+        port->write(record->length);
+        port->write(record->data, dataSize);
+
+        if (++index == MODBUS_TRACE_DEPTH)
+            index = 0;
+    }
+#else
+    (void)port;
+#endif
+}
+
+#if MODBUS_TRACE_DEPTH
+// record the first bytes of frame[] in the trace, overwriting the oldest record when full
+void traceFrame(unsigned int length, unsigned char info)
+{
+    TraceRecord* record = &trace[traceNext];
+    record->time = micros();
+    record->info = info;
+    record->length = length > 255 ? 255 : length;
+    memcpy(record->data, frame, length < MODBUS_TRACE_BYTES ? length : MODBUS_TRACE_BYTES);
+
+    if (++traceNext == MODBUS_TRACE_DEPTH)
+        traceNext = 0;
+    if (traceCount < MODBUS_TRACE_DEPTH)
+        traceCount++;
+}
+
+// set the outcome of the most recent record once the frame has been checked
+void traceOutcome(unsigned char info)
+{
+    trace[(traceNext ? traceNext : MODBUS_TRACE_DEPTH) - 1].info = info;
+}
+#endif
+
+#if MODBUS_ISR_RX
+// a byte from the receive interrupt, dropped when the ring is full
+void modbus_rx_byte(unsigned char c)
+{
+    unsigned int next = rxHead + 1;
+    if (next == BUFFER_SIZE)
+        next = 0;
+    if (next == rxTail)
+        return; // the response is cut, its CRC fails
+    rxRing[rxHead] = c;
+    rxHead = next;
+}
+
+unsigned char rxRead()
+{
+    unsigned char c = rxRing[rxTail];
+    unsigned int next = rxTail + 1;
+    if (next == BUFFER_SIZE)
+        next = 0;
+    rxTail = next;
+    return c;
+}
+
+#ifdef __AVR__
+#if defined(USART_RX_vect)
+ISR(USART_RX_vect)
+#elif defined(USART0_RX_vect)
+ISR(USART0_RX_vect)
+#else
+#error "MODBUS_ISR_RX needs a board with USART0"
+#endif
+{
+    modbus_rx_byte(UDR0);
+}
+#endif
+#endif
\ No newline at end of file
@@ -1,146 +1,397 @@
-#ifndef SIMPLE_MODBUS_MASTER_H
-#define SIMPLE_MODBUS_MASTER_H
-
-/*
-  SimpleModbusMaster allows you to communicate
-  to any slave using the Modbus RTU protocol.
-  
-  To communicate with a slave you need to create a
-  packet that will contain all the information
-  required to communicate to the slave. There are
-  numerous counters for easy diagnostic.
-  These are variables already implemented in a
-  packet. You can set and clear these variables
-  as needed.
-  
-  There are general modbus information counters:
-  requests - contains the total requests to a slave
-  successful_requests - contains the total successful requests
-  total_errors - contains the total errors as a sum
-  timeout - contains the total time out errors
-  incorrect_id_returned - contains the total incorrect id returned errors
-  incorrect_function_returned - contains the total incorrect function returned errors
-  incorrect_bytes_returned - contains the total incorrect bytes returned errors
-  checksum_failed - contains the total checksum failed errors
-  buffer_errors - contains the total buffer errors
-  
-  And there are modbus specific exception counters:
-  illegal_function - contains the total illegal_function errors
-  illegal_data_address - contains the total illegal_data_address errors
-  illegal_data_value - contains the total illegal_data_value errors
-  misc_exceptions - contains the total miscellaneous returned exceptions
-  
-  And finally there is variable called "connection" that
-  at any given moment contains the current connection
-  status of the packet. If true then the connection is
-  active. If false then communication will be stopped
-  on this packet untill the programmer sets the connections
-  variable to true explicitly. The reason for this is
-  because of the time out involved in modbus communication.
-  EACH faulty slave that's not communicating will slow down
-  communication on the line with the time out value. E.g.
-  Using a time out of 1500ms, if you have 10 slaves and 9 of them
-  stops communicating the latency burden placed on communication
-  will be 1500ms * 9 = 13,5 seconds!!!!
-  
-  In addition to this when all the packets are scanned and
-  all of them have a false connection a value is returned
-  from modbus_port() to inform you something is wrong with
-  the port. This is most likely to happen when there is
-  something physically wrong with the RS485 line.
-  This is only for information. You have to explicitly set
-  each packets connection attribute to false.
-  Packets scanning and communication will automatically
-  revert to normal.
-  
-  All the error checking, updating and communication multitasking
-  takes place in the background!
-  
-  In general to communicate with to a slave using modbus
-  RTU you will request information using the specific
-  slave id, the function request, the starting address
-  and lastly the number of registers to request.
-  Function 3 & 16 are supported. In addition to
-  this broadcasting (id = 0) is supported for function 16.
-  Constants are provided for:
-  Function 3 -  READ_HOLDING_REGISTERS
-  Function 16 - PRESET_MULTIPLE_REGISTERS
-  
-      Note:
-  The Arduino serial ring buffer is 128 bytes or 64 registers.
-  Most of the time you will connect the arduino to a master via serial
-  using a MAX485 or similar.
-  
-  In a function 3 request the master will attempt to read from your
-  slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-  and two BYTES CRC the master can only request 122 bytes or 61 registers.
-  
-  In a function 16 request the master will attempt to write to your
-  slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
-  NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-  118 bytes or 59 registers.
-  
-  Using the FTDI USB to Serial converter the maximum bytes you can send is limited
-  to its internal buffer which is 60 bytes or 30 unsigned int registers.
-  
-  Thus:
-  
-  In a function 3 request the master will attempt to read from your
-  slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-  and two BYTES CRC the master can only request 54 bytes or 27 registers.
-  
-  In a function 16 request the master will attempt to write to your
-  slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
-  NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-  50 bytes or 25 registers.
-  
-  Since it is assumed that you will mostly use the Arduino to connect to a
-  master without using a USB to Serial converter the internal buffer is set
-  the same as the Arduino Serial ring buffer which is 128 bytes.
-*/
-
-#include "Arduino.h"
-
-#define READ_HOLDING_REGISTERS 3
-#define	PRESET_MULTIPLE_REGISTERS 16
-
-typedef struct {
-    // specific packet info
-    unsigned char id;
-    unsigned char function;
-    unsigned int address;
-    unsigned int no_of_registers;
-    unsigned int* register_array;
-
-    // modbus information counters
-    unsigned int requests;
-    unsigned int successful_requests;
-    unsigned long total_errors;
-    unsigned int retries;
-    unsigned int timeout;
-    unsigned int incorrect_id_returned;
-    unsigned int incorrect_function_returned;
-    unsigned int incorrect_bytes_returned;
-    unsigned int checksum_failed;
-    unsigned int buffer_errors;
-
-    // modbus specific exception counters
-    unsigned int illegal_function;
-    unsigned int illegal_data_address;
-    unsigned int illegal_data_value;
-    unsigned char misc_exceptions;
-
-    // connection status of packet
-    unsigned char connection;
-
-} Packet;
-
-typedef Packet* packetPointer;
-
-// function definitions
-unsigned int modbus_update(Packet* packets);
-void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling,
-                      unsigned char _retry_count, unsigned char _TxEnablePin,
-                      Packet* packets, unsigned int _total_no_of_packets);
-
-#endif
+#ifndef SIMPLE_MODBUS_MASTER_H
+#define SIMPLE_MODBUS_MASTER_H
+
+/*
+  SimpleModbusMaster allows you to communicate
+  to any slave using the Modbus RTU protocol.
+  
+  To communicate with a slave you need to create a
+  packet that will contain all the information
+  required to communicate to the slave. There are
+  numerous counters for easy diagnostic.
+  These are variables already implemented in a
+  packet. You can set and clear these variables
+  as needed.
+  
+  There are general modbus information counters:
+  requests - contains the total requests to a slave
+  successful_requests - contains the total successful requests
+  total_errors - contains the total errors, it is counted along with
+                 the counters below (not summed up from them), so
+                 clear it too when you clear one of them
+  timeout - contains the total time out errors
+  incorrect_id_returned - contains the total incorrect id returned errors
+  incorrect_function_returned - contains the total incorrect function returned errors
+  incorrect_bytes_returned - contains the total incorrect bytes returned errors
+  checksum_failed - contains the total checksum failed errors
+  buffer_errors - contains the total buffer errors
+  
+  And there are modbus specific exception counters:
+  illegal_function - contains the total illegal_function errors
+  illegal_data_address - contains the total illegal_data_address errors
+  illegal_data_value - contains the total illegal_data_value errors
+  misc_exceptions - contains the total miscellaneous returned exceptions
+  
+  And finally there is variable called "connection" that
+  at any given moment contains the current connection
+  status of the packet. If true then the connection is
+  active. If false then communication will be stopped
+  on this packet untill the programmer sets the connections
+  variable to true explicitly. The reason for this is
+  because of the time out involved in modbus communication.
+  EACH faulty slave that's not communicating will slow down
+  communication on the line with the time out value. E.g.
+  Using a time out of 1500ms, if you have 10 slaves and 9 of them
+  stops communicating the latency burden placed on communication
+  will be 1500ms * 9 = 13,5 seconds!!!!
+  
+  In addition to this when all the packets are scanned and
+  all of them have a false connection a value is returned
+  from modbus_port() to inform you something is wrong with
+  the port. This is most likely to happen when there is
+  something physically wrong with the RS485 line.
+  This is only for information. You have to explicitly set
+  each packets connection attribute to false.
+  Packets scanning and communication will automatically
+  revert to normal.
+  
+  The counters take most of a Packet, about 40 bytes on an AVR.
+  With many packets on a small board set MODBUS_STATISTICS with
+  a compiler flag:
+  MODBUS_STATS_FULL - the counters above (the default)
+  MODBUS_STATS_COMPACT - the same counters as unsigned chars that
+  stop at 255, 23 bytes a packet; clear them now and then
+  MODBUS_STATS_NONE - no counters, only retries and connection
+  are left, 10 bytes a packet
+  Scanning, retries and the connection status work the same at
+  every level.
+  
+  Apart from the per packet counters the master accounts
+  for where the bus time goes. modbus_bus_stats() copies
+  the accumulated time, in microseconds, into a BusStats:
+  transmit - time spent sending requests, the frame delay before
+  each one is idle
+  turnaround - time waiting for the first byte of a response
+  receive - time spent reading a response from the serial buffer
+  polling - time spent in the polling delay
+  timeout - time lost waiting for responses that never came
+  idle - time with no request outstanding
+  errors - failed transactions of all packets together (not a time)
+  The counters are unsigned long and the times wrap around after
+  about 71 minutes, so compare two snapshots by subtracting them
+  or clear them with modbus_clear_bus_stats().
+  
+  Frame tracing
+  For post-mortem analysis the last MODBUS_TRACE_DEPTH frames
+  can be kept in a ring buffer. The trace is compiled out when
+  MODBUS_TRACE_DEPTH is 0 (the default), set it with a compiler
+  flag e.g. -DMODBUS_TRACE_DEPTH=8. Only the first
+  MODBUS_TRACE_BYTES bytes of each frame are kept.
+  modbus_trace_dump() writes the trace, oldest frame first, to
+  another port in this binary layout:
+  1 byte  - number of records
+  and for every record:
+  4 bytes - micros() when the frame was handled, Hi byte first
+  1 byte  - TRACE_TX for a transmitted frame ORed with the outcome
+  1 byte  - length of the frame on the line
+  n bytes - the frame, n = min(length, MODBUS_TRACE_BYTES)
+  A timeout is recorded as a record with length 0.
+  
+  Retries
+  A response that arrives garbled (checksum failed, too long,
+  wrong id or function or wrong byte count) is usually noise, so
+  the same packet is sent again after a short retry delay
+  instead of waiting out the polling delay and the rest of the
+  scan. An exception is the slave's real answer and would come
+  again, it waits out the polling delay like before. To keep a bad slave from holding up the line only
+  a number of these immediate retries are allowed per scan of
+  packets[], after that and on the last retry the polling delay
+  applies as before. The defaults are a retry delay of T3.5 and
+  4 retries per scan, change them after modbus_configure() with
+  modbus_configure_retries(retry delay in us, retries per scan).
+  A budget of 0 turns immediate retries off. Timeouts are never
+  retried early.
+  
+  Discovery
+  To find out which slaves answer on a new segment call
+  modbus_discover(first id, last id, callback). From then on
+  modbus_update() sends every address a read of holding
+  register 0 instead of scanning packets[] and calls the
+  callback for each address that answers with the id, the
+  turnaround in microseconds and the exception code of the
+  answer (0 for a normal response, DISCOVERY_GARBLED when the
+  answer was broken). An address that stays silent is skipped
+  after a short timeout of MODBUS_DISCOVERY_T35 frame delays,
+  raised to twice the slowest turnaround seen so far, so the
+  sweep of all 247 addresses takes seconds rather than the
+  minutes of the normal timeout. A slave slower than that is
+  missed: its late answer is dropped, the next probe waits for
+  T3.5 of silence after it and only an answer from the id asked
+  is reported. modbus_discovering() returns 1 until the sweep is
+  done, then the scan carries on.
+  
+  Listening in
+  modbus_sniff(port, format) turns the master into a listener
+  on a line shared with other masters and slaves: modbus_update()
+  no longer sends anything, TxEnablePin stays low, and every
+  frame on the line, split at the T3.5 gaps, is written to port.
+  A frame from the slave that was addressed by the frame before
+  is marked as its response. With SNIFF_BINARY every frame is a
+  record in the modbus_trace_dump() layout, the info byte being
+  SNIFF_RESPONSE, SNIFF_CHECKSUM_FAILED and SNIFF_OVERFLOW ORed
+  together. SNIFF_TEXT writes a line per frame instead:
+  0012d687 > 01 03 00 00 00 01 84 0a
+  0012e1c4 < 01 03 02 00 2a 38 5b
+  with micros() in hex, > for requests and < for responses.
+  The frame is taken apart as soon as the line goes quiet, so
+  call modbus_update() at least every T3.5 and give port more
+  bandwidth than the line (text needs about three times as
+  much) or it holds up the reading. Frames longer than the
+  buffer are cut off. modbus_sniff(0, 0) goes back to scanning.
+  
+  On demand requests
+  Besides the packets that are scanned over and over, one-off
+  requests such as an operator's write can be queued with
+  modbus_request(). The packet you pass is sent as it is and
+  retried like any other until it succeeds or has failed
+  retry_count times, then it leaves the queue and the callback,
+  if any, is called with the packet and 1 for success or 0 for
+  failure. The counters of the packet tell what went wrong. The
+  packet must stay untouched until then.
+  Normal requests are sent when the scan of packets[] wraps
+  around, urgent ones as soon as the transaction on the line
+  is done, ahead of the scan. The queue holds MODBUS_QUEUE_SIZE
+  requests (4 by default) in a static array, modbus_request()
+  returns 0 when it is full. With no packets to scan
+  (_total_no_of_packets 0) the master only sends queued requests.
+  
+  Frame timing
+  T1.5, the silence that ends a frame, and T3.5, the silence
+  between two frames, follow from the time of one character: a
+  start bit, the data bits, the parity bit if any and the stop
+  bits at the baud rate. modbus_configure() picks TIMING_SPEC for
+  10 bit characters (8N1), choose another profile afterwards with
+  modbus_configure_timing(profile, bits per character, T1.5 us,
+  T3.5 us):
+  TIMING_SPEC   1.5 and 3.5 characters, or the fixed 750 us and
+                1750 us the spec asks for above 19200 baud
+  TIMING_FAST   1.5 and 3.5 characters at every baud rate, e.g.
+                130 us and 304 us at 115200 baud 8N1
+  TIMING_CUSTOM the T1.5 and T3.5 given, in microseconds
+  The times given are only used by TIMING_CUSTOM. The bits per
+  character only enter the timing. The retry delay follows the
+  new T3.5 unless modbus_configure_retries() set it. Called
+  before modbus_configure() or with 0 bits per character it does
+  nothing.
+  
+  The port is set up for 8N1. For another format, e.g. the 8E1
+  of the spec, call modbus_configure_port(SERIAL_8E1) before or
+  after modbus_configure() and give modbus_configure_timing() its
+  11 bits per character. Don't call Serial.begin() yourself: the
+  format would be lost when modbus_configure() starts the port
+  again, and in MODBUS_ISR_RX mode it would bring in the core's
+  receive interrupt, which clashes with the library's.
+  
+  All the error checking, updating and communication multitasking
+  takes place in the background!
+  
+  In general to communicate with to a slave using modbus
+  RTU you will request information using the specific
+  slave id, the function request, the starting address
+  and lastly the number of registers to request.
+  Function 3 & 16 are supported. In addition to
+  this broadcasting (id = 0) is supported for function 16.
+  Constants are provided for:
+  Function 3 -  READ_HOLDING_REGISTERS
+  Function 16 - PRESET_MULTIPLE_REGISTERS
+  
+      Note:
+  A frame holds up to MODBUS_BUFFER_SIZE bytes, 128 by default,
+  so the master can read 61 and write 59 registers in one
+  request. Set it to 256 with a compiler flag for the longest
+  RTU frame, a function 3 response of 125 registers or a
+  function 16 request of 123 registers, at the cost of another
+  128 bytes of RAM. Longer requests are never sent and count as
+  buffer errors.
+  
+  The serial ring buffer of the Arduino core is 64 bytes on most
+  boards, the bytes of a longer response are lost when the sketch
+  doesn't call modbus_update() before it fills (5.5 ms at 115200
+  baud). With MODBUS_ISR_RX set to 1 the library takes the bytes
+  in the USART0 receive interrupt itself, into a ring buffer of
+  MODBUS_BUFFER_SIZE bytes, so a whole response waits there
+  however long loop() takes. The library then drives USART0 and
+  the sketch must not use Serial. On boards other than the AVR
+  ones call modbus_rx_byte() from the receive interrupt instead.
+  
+  Using the FTDI USB to Serial converter the maximum bytes you can send is limited
+  to its internal buffer which is 60 bytes or 30 unsigned int registers.
+  
+  Thus:
+  
+  In a function 3 request the master will attempt to read from your
+  slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
+  and two BYTES CRC the master can only request 54 bytes or 27 registers.
+  
+  In a function 16 request the master will attempt to write to your
+  slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
+  NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
+  50 bytes or 25 registers.
+*/
+
+#include "Arduino.h"
+
+#define READ_HOLDING_REGISTERS 3
+#define	PRESET_MULTIPLE_REGISTERS 16
+
+// statistics levels
+#define MODBUS_STATS_NONE 0
+#define MODBUS_STATS_COMPACT 1
+#define MODBUS_STATS_FULL 2
+
+#ifndef MODBUS_STATISTICS
+#define MODBUS_STATISTICS MODBUS_STATS_FULL // counters kept in every packet
+#endif
+
+#ifndef MODBUS_BUFFER_SIZE
+#define MODBUS_BUFFER_SIZE 128 // longest frame sent or received, up to 256
+#endif
+
+#ifndef MODBUS_ISR_RX
+#define MODBUS_ISR_RX 0 // receive into the library's buffer in the USART interrupt
+#endif
+
+#ifndef MODBUS_TRACE_DEPTH
+#define MODBUS_TRACE_DEPTH 0 // number of frames kept in the trace, 0 disables it
+#endif
+
+#ifndef MODBUS_TRACE_BYTES
+#define MODBUS_TRACE_BYTES 16 // bytes kept of each traced frame
+#endif
+
+#ifndef MODBUS_DISCOVERY_T35
+#define MODBUS_DISCOVERY_T35 8 // first discovery timeout in frame delays
+#endif
+
+#ifndef MODBUS_QUEUE_SIZE
+#define MODBUS_QUEUE_SIZE 4 // on demand requests that can wait at once
+#endif
+
+// trace record outcomes
+#define TRACE_OK 0
+#define TRACE_TIMEOUT 1
+#define TRACE_BUFFER_ERROR 2
+#define TRACE_INCORRECT_ID 3
+#define TRACE_INCORRECT_FUNCTION 4
+#define TRACE_INCORRECT_BYTES 5
+#define TRACE_CHECKSUM_FAILED 6
+#define TRACE_EXCEPTION 7
+#define TRACE_TX 0x80 // set on frames that were transmitted
+
+// frame timing profiles
+#define TIMING_SPEC 0
+#define TIMING_FAST 1
+#define TIMING_CUSTOM 2
+
+#define DISCOVERY_GARBLED 0xFF // something answered the probe but the frame was bad
+
+// listen only output formats and record info bits
+#define SNIFF_BINARY 0
+#define SNIFF_TEXT 1
+#define SNIFF_RESPONSE 0x40 // the frame answers the request before it
+#define SNIFF_CHECKSUM_FAILED 0x20
+#define SNIFF_OVERFLOW 0x10 // the frame was cut off at the buffer size
+
+typedef struct {
+    // specific packet info
+    unsigned char id;
+    unsigned char function;
+    unsigned int address;
+    unsigned int no_of_registers;
+    unsigned int* register_array;
+
+#if MODBUS_STATISTICS == MODBUS_STATS_FULL
+    // modbus information counters
+    unsigned int requests;
+    unsigned int successful_requests;
+    unsigned long total_errors;
+    unsigned int retries;
+    unsigned int timeout;
+    unsigned int incorrect_id_returned;
+    unsigned int incorrect_function_returned;
+    unsigned int incorrect_bytes_returned;
+    unsigned int checksum_failed;
+    unsigned int buffer_errors;
+
+    // modbus specific exception counters
+    unsigned int illegal_function;
+    unsigned int illegal_data_address;
+    unsigned int illegal_data_value;
+    unsigned char misc_exceptions;
+#else
+    unsigned char retries; // retry_count is an unsigned char too
+#if MODBUS_STATISTICS == MODBUS_STATS_COMPACT
+    // modbus information counters, they stop at 255
+    unsigned char requests;
+    unsigned char successful_requests;
+    unsigned char total_errors;
+    unsigned char timeout;
+    unsigned char incorrect_id_returned;
+    unsigned char incorrect_function_returned;
+    unsigned char incorrect_bytes_returned;
+    unsigned char checksum_failed;
+    unsigned char buffer_errors;
+
+    // modbus specific exception counters, they stop at 255
+    unsigned char illegal_function;
+    unsigned char illegal_data_address;
+    unsigned char illegal_data_value;
+    unsigned char misc_exceptions;
+#endif
+#endif
+
+    // connection status of packet
+    unsigned char connection;
+
+} Packet;
+
+typedef Packet* packetPointer;
+
+// called when a queued request is done, ok is 1 on success
+typedef void (*RequestCallback)(Packet* packet, unsigned char ok);
+typedef void (*DiscoveryCallback)(unsigned char id, unsigned char exception, unsigned long turnaround);
+
+typedef struct {
+    // accumulated bus time in microseconds
+    unsigned long transmit;
+    unsigned long turnaround;
+    unsigned long receive;
+    unsigned long polling;
+    unsigned long timeout;
+    unsigned long idle;
+
+    // failed transactions of all packets, at every MODBUS_STATISTICS level
+    unsigned long errors;
+} BusStats;
+
+// function definitions
+unsigned int modbus_update(Packet* packets);
+void modbus_configure(long baud, unsigned int _timeout, unsigned int _polling,
+                      unsigned char _retry_count, unsigned char _TxEnablePin,
+                      Packet* packets, unsigned int _total_no_of_packets);
+void modbus_bus_stats(BusStats* stats);
+void modbus_clear_bus_stats();
+void modbus_trace_dump(Stream* port);
+void modbus_discover(unsigned char first_id, unsigned char last_id, DiscoveryCallback callback);
+unsigned char modbus_discovering();
+void modbus_sniff(Stream* port, unsigned char format);
+void modbus_configure_retries(unsigned int _retry_delay, unsigned char _retry_budget);
+void modbus_configure_timing(unsigned char profile, unsigned char bitsPerChar, unsigned int t1_5, unsigned int t3_5);
+void modbus_configure_port(unsigned int config);
+unsigned char modbus_request(Packet* packet, RequestCallback callback, unsigned char urgent);
+
+#if MODBUS_ISR_RX
+void modbus_rx_byte(unsigned char c); // from the receive interrupt on boards other than AVR
+#endif
+
+#endif
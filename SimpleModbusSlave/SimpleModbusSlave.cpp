@@ -1,238 +1,736 @@
-#include "SimpleModbusSlave.h"
-
-#define BUFFER_SIZE 128
-
-// frame[] is used to recieve and transmit packages.
-// The maximum serial ring buffer size is 128
-unsigned char frame[BUFFER_SIZE];
-unsigned int holdingRegsSize; // size of the register array
-unsigned char broadcastFlag;
-unsigned char slaveID;
-unsigned char function;
-unsigned char TxEnablePin;
-unsigned int errorCount;
-unsigned int T1_5; // inter character time out
-unsigned int T3_5; // frame delay
-
-// function definitions
-void exceptionResponse(unsigned char exception);
-unsigned int calculateCRC(unsigned char bufferSize);
-void sendPacket(unsigned char bufferSize);
-
-unsigned int modbus_update(unsigned int *holdingRegs)
-{
-    unsigned char buffer = 0;
-    unsigned char overflow = 0;
-
-    while (Serial.available()) {
-        // The maximum number of bytes is limited to the serial buffer size of 128 bytes
-        // If more bytes is received than the BUFFER_SIZE the overflow flag will be set and the
-        // serial buffer will be red untill all the data is cleared from the receive buffer.
-        if (overflow)
-            Serial.read();
-        else {
-            if (buffer == BUFFER_SIZE)
-                overflow = 1;
-            frame[buffer] = Serial.read();
-            buffer++;
-        }
-        delayMicroseconds(T1_5); // inter character time out
-    }
-
-    // If an overflow occurred increment the errorCount
-    // variable and return to the main sketch without
-    // responding to the request i.e. force a timeout
-    if (overflow)
-        return errorCount++;
-
-    // The minimum request packet is 8 bytes for function 3 & 16
-    if (buffer > 6) {
-        unsigned char id = frame[0];
-
-        broadcastFlag = 0;
-
-        if (id == 0)
-            broadcastFlag = 1;
-
-        if (id == slaveID || broadcastFlag) { // if the recieved ID matches the slaveID or broadcasting id (0), continue
-            unsigned int crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); // combine the crc Low & High bytes
-            if (calculateCRC(buffer - 2) == crc) { // if the calculated crc matches the recieved crc continue
-                function = frame[1];
-                unsigned int startingAddress = ((frame[2] << 8) | frame[3]); // combine the starting address bytes
-                unsigned int no_of_registers = ((frame[4] << 8) | frame[5]); // combine the number of register bytes
-                unsigned int maxData = startingAddress + no_of_registers;
-                unsigned char index;
-                unsigned char address;
-                unsigned int crc16;
-
-                // broadcasting is not supported for function 3
-                if (!broadcastFlag && (function == 3)) {
-                    if (startingAddress < holdingRegsSize) { // check exception 2 ILLEGAL DATA ADDRESS
-                        if (maxData <= holdingRegsSize) { // check exception 3 ILLEGAL DATA VALUE
-                            unsigned char noOfBytes = no_of_registers * 2;
-                            unsigned char responseFrameSize = 5 + noOfBytes; // ID, function, noOfBytes, (dataLo + dataHi) * number of registers, crcLo, crcHi
-                            frame[0] = slaveID;
-                            frame[1] = function;
-                            frame[2] = noOfBytes;
-                            address = 3; // PDU starts at the 4th byte
-                            unsigned int temp;
-
-                            for (index = startingAddress; index < maxData; index++) {
-                                temp = holdingRegs[index];
-                                frame[address] = temp >> 8; // split the register into 2 bytes
-                                address++;
-                                frame[address] = temp & 0xFF;
-                                address++;
-                            }
-
-                            crc16 = calculateCRC(responseFrameSize - 2);
-                            frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
-                            frame[responseFrameSize - 1] = crc16 & 0xFF;
-                            sendPacket(responseFrameSize);
-                        } else
-                            exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
-                    } else
-                        exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
-                } else if (function == 6) {
-                    if (startingAddress < holdingRegsSize) { // check exception 2 ILLEGAL DATA ADDRESS
-                        unsigned int startingAddress = ((frame[2] << 8) | frame[3]);
-                        unsigned int regStatus = ((frame[4] << 8) | frame[5]);
-                        unsigned char responseFrameSize = 8;
-
-                        holdingRegs[startingAddress] = regStatus;
-
-                        crc16 = calculateCRC(responseFrameSize - 2);
-                        frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
-                        frame[responseFrameSize - 1] = crc16 & 0xFF;
-                        sendPacket(responseFrameSize);
-                    } else
-                        exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
-                } else if (function == 16) {
-                    // check if the recieved number of bytes matches the calculated bytes minus the request bytes
-                    // id + function + (2 * address bytes) + (2 * no of register bytes) + byte count + (2 * CRC bytes) = 9 bytes
-                    if (frame[6] == (buffer - 9)) {
-                        if (startingAddress < holdingRegsSize) { // check exception 2 ILLEGAL DATA ADDRESS
-                            if (maxData <= holdingRegsSize) { // check exception 3 ILLEGAL DATA VALUE
-                                address = 7; // start at the 8th byte in the frame
-
-                                for (index = startingAddress; index < maxData; index++) {
-                                    holdingRegs[index] = ((frame[address] << 8) | frame[address + 1]);
-                                    address += 2;
-                                }
-
-                                // only the first 6 bytes are used for CRC calculation
-                                crc16 = calculateCRC(6);
-                                frame[6] = crc16 >> 8; // split crc into 2 bytes
-                                frame[7] = crc16 & 0xFF;
-
-                                // a function 16 response is an echo of the first 6 bytes from the request + 2 crc bytes
-                                if (!broadcastFlag) // don't respond if it's a broadcast message
-                                    sendPacket(8);
-                            } else
-                                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
-                        } else
-                            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
-                    } else
-                        errorCount++; // corrupted packet
-                } else
-                    exceptionResponse(1); // exception 1 ILLEGAL FUNCTION
-            } else // checksum failed
-                errorCount++;
-        } // incorrect id
-    } else if (buffer > 0 && buffer < 8)
-        errorCount++; // corrupted packet
-
-    return errorCount;
-}
-
-void exceptionResponse(unsigned char exception)
-{
-    errorCount++; // each call to exceptionResponse() will increment the errorCount
-    if (!broadcastFlag) { // don't respond if its a broadcast message
-        frame[0] = slaveID;
-        frame[1] = (function | 0x80); // set the MSB bit high, informs the master of an exception
-        frame[2] = exception;
-        unsigned int crc16 = calculateCRC(3); // ID, function + 0x80, exception code == 3 bytes
-        frame[3] = crc16 >> 8;
-        frame[4] = crc16 & 0xFF;
-        sendPacket(5); // exception response is always 5 bytes ID, function + 0x80, exception code, 2 bytes crc
-    }
-}
-
-void modbus_configure(long baud, unsigned char _slaveID, unsigned char _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency)
-{
-    slaveID = _slaveID;
-    Serial.begin(baud);
-
-    if (_TxEnablePin > 1) {
-        // pin 0 & pin 1 are reserved for RX/TX. To disable set txenpin < 2
-        TxEnablePin = _TxEnablePin;
-        pinMode(TxEnablePin, OUTPUT);
-        digitalWrite(TxEnablePin, LOW);
-    }
-
-    // Modbus states that a baud rate higher than 19200 must use a fixed 750 us
-    // for inter character time out and 1.75 ms for a frame delay.
-    // For baud rates below 19200 the timeing is more critical and has to be calculated.
-    // E.g. 9600 baud in a 10 bit packet is 960 characters per second
-    // In milliseconds this will be 960characters per 1000ms. So for 1 character
-    // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
-    // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
-    // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
-    // Added experimental low latency delays. This makes the implementation
-    // non-standard but practically it works with all major modbus master implementations.
-
-    if (baud == 1000000 && _lowLatency) {
-        T1_5 = 1;
-        T3_5 = 10;
-    } else if (baud >= 115200 && _lowLatency) {
-        T1_5 = 75;
-        T3_5 = 175;
-    } else if (baud > 19200) {
-        T1_5 = 750;
-        T3_5 = 1750;
-    } else {
-        T1_5 = 15000000/baud; // 1T * 1.5 = T1.5
-        T3_5 = 35000000/baud; // 1T * 3.5 = T3.5
-    }
-
-    holdingRegsSize = _holdingRegsSize;
-    errorCount = 0; // initialize errorCount
-}
-
-unsigned int calculateCRC(byte bufferSize)
-{
-    unsigned int temp, temp2, flag;
-    temp = 0xFFFF;
-    for (unsigned char i = 0; i < bufferSize; i++) {
-        temp = temp ^ frame[i];
-        for (unsigned char j = 1; j <= 8; j++) {
-            flag = temp & 0x0001;
-            temp >>= 1;
-            if (flag)
-                temp ^= 0xA001;
-        }
-    }
-    // Reverse byte order.
-    temp2 = temp >> 8;
-    temp = (temp << 8) | temp2;
-    temp &= 0xFFFF;
-    return temp; // the returned value is already swopped - crcLo byte is first & crcHi byte is last
-}
-
-void sendPacket(unsigned char bufferSize)
-{
-    if (TxEnablePin > 1)
-        digitalWrite(TxEnablePin, HIGH);
-
-    for (unsigned char i = 0; i < bufferSize; i++)
-        Serial.write(frame[i]);
-
-    Serial.flush();
-
-    // allow a frame delay to indicate end of transmission
-    delayMicroseconds(T3_5);
-
-    if (TxEnablePin > 1)
-        digitalWrite(TxEnablePin, LOW);
-}
+#include "SimpleModbusSlave.h"
+
+#define BUFFER_SIZE MODBUS_BUFFER_SIZE
+#define RX_POLL 20 // us between two looks for the next byte of a frame
+
+#if MODBUS_ISR_RX
+unsigned char* frame; // the queued frame being handled, the response is built in it
+#else
+// frame[] is used to recieve and transmit packages.
+unsigned char frame[BUFFER_SIZE];
+#endif
+#if MODBUS_HOLDING_REGS_SIZE
+const unsigned int holdingRegsSize = MODBUS_HOLDING_REGS_SIZE;
+#else
+unsigned int holdingRegsSize; // size of the register array
+#endif
+unsigned char broadcastFlag;
+unsigned char slaveID;
+unsigned char function;
+unsigned char TxEnablePin;
+unsigned int errorCount;
+unsigned int T1_5; // inter character time out
+unsigned int T3_5; // frame delay
+long baudRate;
+unsigned int portConfig = SERIAL_8N1; // data bits, parity and stop bits for Serial.begin()
+unsigned char timingProfile; // last given to modbus_configure_timing()
+unsigned char timingBits;
+unsigned char foreignFrame; // a frame for another slave is on the line
+unsigned long lastForeignByte; // micros() when its last byte was dropped
+unsigned long lineQuiet; // micros() when the last byte of the request came in
+const long* autoBauds; // candidate baud rates while hunting, 0 once locked
+unsigned char autoBaudCount;
+unsigned char autoBaudIndex; // the candidate listened at
+unsigned int autoBaudDwell; // ms to listen at each candidate
+unsigned long autoBaudStart; // millis() when listening started
+
+#if MODBUS_ISR_RX
+#define RX_IDLE 0 // the line has been quiet for T3.5
+#define RX_FRAME 1 // a frame is coming in
+#define RX_GAP 2 // T1.5 after a frame, a byte now is an error
+
+// frame status in the queue
+#define RX_OK 0
+#define RX_ERROR 1 // overflow, a byte error or a late byte
+
+typedef struct {
+    unsigned char data[BUFFER_SIZE];
+    unsigned int length;
+    unsigned char status;
+} RxFrame;
+
+RxFrame rxQueue[MODBUS_RX_FRAMES];
+volatile unsigned char rxHead; // frames queued, written by the interrupt
+volatile unsigned char rxTail; // frames handled, written by modbus_update()
+volatile unsigned char rxState;
+unsigned int rxLength; // of the frame coming in
+unsigned char rxStatus;
+unsigned char rxDrop; // the frame coming in is for another slave or the queue is full
+#ifdef __AVR__
+volatile unsigned char rxTimerWraps; // timer 2 overflows since the last byte
+unsigned char t1_5Wraps; // overflows before the T1.5 match counts
+unsigned char t3_5Wraps;
+#endif
+
+void rxTimerStart();
+#endif
+
+// function definitions
+unsigned int handleFrame(unsigned int *holdingRegs, unsigned int buffer, unsigned char overflow);
+void exceptionResponse(unsigned char exception);
+unsigned int calculateCRC(unsigned int bufferSize);
+unsigned int crcByte(unsigned int crc, unsigned char c);
+void sendPacket(unsigned int bufferSize);
+void txBegin();
+void txByte(unsigned char c);
+void txEnd(unsigned int bufferSize);
+void beginPort(long baud);
+void autoBaudListen();
+unsigned char lockableFrame(unsigned int buffer);
+
+#if MODBUS_TRACE_DEPTH
+typedef struct {
+    unsigned long time; // micros() when the frame was handled
+    unsigned char info; // TRACE_TX | outcome
+    unsigned char length; // length of the frame on the line
+    unsigned char data[MODBUS_TRACE_BYTES];
+} TraceRecord;
+
+TraceRecord trace[MODBUS_TRACE_DEPTH];
+unsigned char traceNext; // slot of the next record
+unsigned char traceCount; // number of valid records
+
+void traceFrame(unsigned int length, unsigned char info);
+void traceOutcome(unsigned char info);
+
+#define TRACE_FRAME(length, info) traceFrame(length, info)
+#define TRACE_OUTCOME(info) traceOutcome(info)
+#else
+#define TRACE_FRAME(length, info) ((void)0)
+#define TRACE_OUTCOME(info) ((void)0)
+#endif
+
+unsigned int modbus_update(unsigned int *holdingRegs)
+{
+    if (autoBauds && (millis() - autoBaudStart) > autoBaudDwell) {
+        // nothing valid was heard at this rate, try the next one
+        if (++autoBaudIndex == autoBaudCount)
+            autoBaudIndex = 0;
+        autoBaudListen();
+    }
+
+#if MODBUS_ISR_RX
+    // the interrupt has split the line into frames, take the oldest
+    if (rxTail == rxHead)
+        return errorCount;
+    // it is handled in its slot, which stays taken until the response is out
+    RxFrame* received = &rxQueue[rxTail % MODBUS_RX_FRAMES];
+    frame = received->data;
+    unsigned int result = handleFrame(holdingRegs, received->length, received->status);
+    rxTail++; // the slot is free again
+    return result;
+#else
+    unsigned int buffer = 0;
+    unsigned char overflow = 0;
+
+    while (!foreignFrame && Serial.available()) {
+        // The maximum number of bytes is limited to BUFFER_SIZE.
+        // If more bytes is received than the BUFFER_SIZE the overflow flag will be set and the
+        // serial buffer will be red untill all the data is cleared from the receive buffer.
+        if (overflow || buffer == BUFFER_SIZE) {
+            overflow = 1;
+            Serial.read();
+        } else {
+            frame[buffer] = Serial.read();
+            buffer++;
+
+            // the first byte tells whether the frame is for this slave,
+            // while hunting for the baud rate every frame is checked
+            if (buffer == 1 && !autoBauds && frame[0] != slaveID && frame[0] != 0) {
+                foreignFrame = 1;
+                lastForeignByte = micros();
+                break;
+            }
+        }
+
+        // Wait for the next byte up to the inter character time out. It
+        // is read as soon as it arrives rather than one byte per T1.5,
+        // so the serial buffer doesn't fill up during a long frame.
+        lineQuiet = micros();
+        while (!Serial.available() && (micros() - lineQuiet) <= T1_5)
+            delayMicroseconds(RX_POLL);
+    }
+
+    // The rest of a frame for another slave is dropped as it comes
+    // in, without buffering it, checking its CRC or waiting on it,
+    // until the line has been quiet for T1.5. The sketch gets the
+    // time back instead of spending it in the delays above.
+    if (foreignFrame) {
+        while (Serial.available()) {
+            Serial.read();
+            lastForeignByte = micros();
+        }
+        if ((micros() - lastForeignByte) > T1_5)
+            foreignFrame = 0; // the frame has ended
+        return errorCount;
+    }
+
+    return handleFrame(holdingRegs, buffer, overflow);
+#endif
+}
+
+// check the frame received into frame[] and answer it
+unsigned int handleFrame(unsigned int *holdingRegs, unsigned int buffer, unsigned char overflow)
+{
+    if (autoBauds) {
+        // A frame with a valid CRC and the length its function asks for,
+        // whoever it is for, means the rate is right. Anything else is
+        // what the wrong rate makes of the line and isn't counted as an
+        // error.
+        if (overflow || buffer < 5 || !lockableFrame(buffer))
+            return errorCount;
+        unsigned int crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]);
+        if (calculateCRC(buffer - 2) != crc)
+            return errorCount;
+        autoBauds = 0; // locked
+    }
+
+    // If an overflow occurred increment the errorCount
+    // variable and return to the main sketch without
+    // responding to the request i.e. force a timeout
+    if (overflow) {
+        TRACE_FRAME(buffer, TRACE_BUFFER_ERROR);
+        return errorCount++;
+    }
+
+    // The minimum request packet is 8 bytes for function 3 & 16
+    if (buffer > 6) {
+        unsigned char id = frame[0];
+
+        broadcastFlag = 0;
+
+        if (id == 0)
+            broadcastFlag = 1;
+
+        if (id == slaveID || broadcastFlag) { // if the recieved ID matches the slaveID or broadcasting id (0), continue
+            unsigned int crc = ((frame[buffer - 2] << 8) | frame[buffer - 1]); // combine the crc Low & High bytes
+            if (calculateCRC(buffer - 2) == crc) { // if the calculated crc matches the recieved crc continue
+                TRACE_FRAME(buffer, TRACE_OK);
+                function = frame[1];
+                unsigned int startingAddress = ((frame[2] << 8) | frame[3]); // combine the starting address bytes
+#if MODBUS_FUNCTION_3 || MODBUS_FUNCTION_16
+                unsigned int no_of_registers = ((frame[4] << 8) | frame[5]); // combine the number of register bytes
+                unsigned int maxData = startingAddress + no_of_registers;
+                unsigned int index;
+                unsigned int address;
+#endif
+                unsigned int crc16;
+
+                // only the functions compiled in are dispatched, see MODBUS_FUNCTION_3 ...
+                switch (function) {
+#if MODBUS_FUNCTION_3
+                case 3:
+                    if (broadcastFlag) { // broadcasting is not supported for function 3
+                        exceptionResponse(1);
+                        break;
+                    }
+                    if (startingAddress < holdingRegsSize) { // check exception 2 ILLEGAL DATA ADDRESS
+                        // check exception 3 ILLEGAL DATA VALUE, the response has to fit frame[] too
+                        if (no_of_registers >= 1 && no_of_registers <= 125 && maxData <= holdingRegsSize &&
+                            5 + no_of_registers * 2 <= BUFFER_SIZE) {
+                            unsigned char noOfBytes = no_of_registers * 2;
+                            unsigned int responseFrameSize = 5 + noOfBytes; // ID, function, noOfBytes, (dataLo + dataHi) * number of registers, crcLo, crcHi
+                            frame[0] = slaveID;
+                            frame[1] = function;
+                            frame[2] = noOfBytes;
+                            unsigned int temp;
+
+                            // The response goes out as it is encoded and the CRC is
+                            // folded in byte by byte, so the first byte is on the line
+                            // at once whatever the number of registers. frame[] is
+                            // still filled for the trace.
+                            txBegin();
+                            crc16 = 0xFFFF;
+                            for (address = 0; address < 3; address++) {
+                                txByte(frame[address]);
+                                crc16 = crcByte(crc16, frame[address]);
+                            }
+
+                            for (index = startingAddress; index < maxData; index++) {
+                                temp = holdingRegs[index];
+                                frame[address] = temp >> 8; // split the register into 2 bytes
+                                txByte(frame[address]);
+                                crc16 = crcByte(crc16, frame[address]);
+                                address++;
+                                frame[address] = temp & 0xFF;
+                                txByte(frame[address]);
+                                crc16 = crcByte(crc16, frame[address]);
+                                address++;
+                            }
+
+                            frame[responseFrameSize - 2] = crc16 & 0xFF; // crcLo first, not swopped here
+                            frame[responseFrameSize - 1] = crc16 >> 8;
+                            txByte(frame[responseFrameSize - 2]);
+                            txByte(frame[responseFrameSize - 1]);
+                            txEnd(responseFrameSize);
+                        } else
+                            exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+                    } else
+                        exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+                    break;
+#endif
+#if MODBUS_FUNCTION_6
+                case 6:
+                    if (startingAddress < holdingRegsSize) { // check exception 2 ILLEGAL DATA ADDRESS
+                        unsigned int startingAddress = ((frame[2] << 8) | frame[3]);
+                        unsigned int regStatus = ((frame[4] << 8) | frame[5]);
+                        unsigned int responseFrameSize = 8;
+
+                        holdingRegs[startingAddress] = regStatus;
+
+                        crc16 = calculateCRC(responseFrameSize - 2);
+                        frame[responseFrameSize - 2] = crc16 >> 8; // split crc into 2 bytes
+                        frame[responseFrameSize - 1] = crc16 & 0xFF;
+                        sendPacket(responseFrameSize);
+                    } else
+                        exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+                    break;
+#endif
+#if MODBUS_FUNCTION_16
+                case 16:
+                    // check if the recieved number of bytes matches the calculated bytes minus the request bytes
+                    // id + function + (2 * address bytes) + (2 * no of register bytes) + byte count + (2 * CRC bytes) = 9 bytes
+                    if (frame[6] == (buffer - 9)) {
+                        if (startingAddress < holdingRegsSize) { // check exception 2 ILLEGAL DATA ADDRESS
+                            // check exception 3 ILLEGAL DATA VALUE, the byte count has to carry the registers
+                            if (no_of_registers >= 1 && frame[6] == no_of_registers * 2 && maxData <= holdingRegsSize) {
+                                address = 7; // start at the 8th byte in the frame
+
+                                for (index = startingAddress; index < maxData; index++) {
+                                    holdingRegs[index] = ((frame[address] << 8) | frame[address + 1]);
+                                    address += 2;
+                                }
+
+                                // only the first 6 bytes are used for CRC calculation
+                                crc16 = calculateCRC(6);
+                                frame[6] = crc16 >> 8; // split crc into 2 bytes
+                                frame[7] = crc16 & 0xFF;
+
+                                // a function 16 response is an echo of the first 6 bytes from the request + 2 crc bytes
+                                if (!broadcastFlag) // don't respond if it's a broadcast message
+                                    sendPacket(8);
+                            } else
+                                exceptionResponse(3); // exception 3 ILLEGAL DATA VALUE
+                        } else
+                            exceptionResponse(2); // exception 2 ILLEGAL DATA ADDRESS
+                    } else {
+                        TRACE_OUTCOME(TRACE_INCORRECT_BYTES);
+                        errorCount++; // corrupted packet
+                    }
+                    break;
+#endif
+                default:
+                    exceptionResponse(1); // exception 1 ILLEGAL FUNCTION
+                }
+            } else { // checksum failed
+                TRACE_FRAME(buffer, TRACE_CHECKSUM_FAILED);
+                errorCount++;
+            }
+        } // incorrect id
+    } else if (buffer > 0 && buffer < 8) {
+        TRACE_FRAME(buffer, TRACE_BUFFER_ERROR);
+        errorCount++; // corrupted packet
+    }
+
+    return errorCount;
+}
+
+void exceptionResponse(unsigned char exception)
+{
+    errorCount++; // each call to exceptionResponse() will increment the errorCount
+    if (!broadcastFlag) { // don't respond if its a broadcast message
+        frame[0] = slaveID;
+        frame[1] = (function | 0x80); // set the MSB bit high, informs the master of an exception
+        frame[2] = exception;
+        unsigned int crc16 = calculateCRC(3); // ID, function + 0x80, exception code == 3 bytes
+        frame[3] = crc16 >> 8;
+        frame[4] = crc16 & 0xFF;
+        sendPacket(5); // exception response is always 5 bytes ID, function + 0x80, exception code, 2 bytes crc
+    }
+}
+
+void modbus_configure(long baud, unsigned char _slaveID, unsigned char _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency)
+{
+    slaveID = _slaveID;
+    autoBauds = 0;
+    beginPort(baud);
+
+    if (_TxEnablePin > 1) {
+        // pin 0 & pin 1 are reserved for RX/TX. To disable set txenpin < 2
+        TxEnablePin = _TxEnablePin;
+        pinMode(TxEnablePin, OUTPUT);
+        digitalWrite(TxEnablePin, LOW);
+    }
+
+    // the low latency option predates the timing profiles and picks the fast one
+    modbus_configure_timing(_lowLatency ? TIMING_FAST : TIMING_SPEC, 10, 0, 0); // 8N1
+
+#if MODBUS_HOLDING_REGS_SIZE
+    (void)_holdingRegsSize; // fixed at compile time
+#else
+    holdingRegsSize = _holdingRegsSize;
+#endif
+    foreignFrame = 0;
+    errorCount = 0; // initialize errorCount
+
+#if MODBUS_ISR_RX
+    rxState = RX_IDLE;
+    rxHead = rxTail = 0;
+#endif
+}
+
+void modbus_configure_timing(unsigned char profile, unsigned char bitsPerChar, unsigned int t1_5, unsigned int t3_5)
+{
+    if (!baudRate || !bitsPerChar)
+        return; // before modbus_configure(), which sets the timing itself
+
+    // Modbus states that a baud rate higher than 19200 must use a fixed 750 us
+    // for inter character time out and 1.75 ms for a frame delay.
+    // For baud rates below 19200 the timeing is more critical and has to be calculated.
+    // E.g. 9600 baud in a 10 bit character (8N1) is 960 characters per second
+    // In milliseconds this will be 960characters per 1000ms. So for 1 character
+    // 1000ms/960characters is 1.04167ms per character and finaly modbus states an
+    // intercharacter must be 1.5T or 1.5 times longer than a normal character and thus
+    // 1.5T = 1.04167ms * 1.5 = 1.5625ms. A frame delay is 3.5T.
+    // TIMING_FAST keeps the character times above 19200 too.
+    timingProfile = profile;
+    timingBits = bitsPerChar;
+    if (profile == TIMING_CUSTOM) {
+        T1_5 = t1_5;
+        T3_5 = t3_5;
+    } else if (profile == TIMING_SPEC && baudRate > 19200) {
+        T1_5 = 750;
+        T3_5 = 1750;
+    } else {
+        unsigned long charTime15 = bitsPerChar * 1500000UL / baudRate; // 1T * 1.5 = T1.5
+        unsigned long charTime35 = bitsPerChar * 3500000UL / baudRate; // 1T * 3.5 = T3.5
+        T1_5 = charTime15 < 0xFFFF ? charTime15 : 0xFFFF;
+        T3_5 = charTime35 < 0xFFFF ? charTime35 : 0xFFFF;
+    }
+
+#if MODBUS_ISR_RX && defined(__AVR__)
+    // timer 2 counts from the last byte, choose the fastest prescaler
+    // that still reaches T3.5 in 255 counts. Below about 2400 baud not
+    // even 1024 does, the overflows are then counted too and a compare
+    // match only takes effect in the overflow it is due in.
+    static const unsigned int prescalers[] = { 1, 8, 32, 64, 128, 256, 1024 };
+    unsigned char select = 0;
+    while (select < 6 && (unsigned long)T3_5 * (F_CPU / 1000000) / prescalers[select] > 255)
+        select++;
+    unsigned long t1_5Counts = (unsigned long)T1_5 * (F_CPU / 1000000) / prescalers[select];
+    unsigned long t3_5Counts = (unsigned long)T3_5 * (F_CPU / 1000000) / prescalers[select];
+    if (t1_5Counts == 0)
+        t1_5Counts = 1;
+    if (t3_5Counts <= t1_5Counts)
+        t3_5Counts = t1_5Counts + 1;
+    // a match at count 0 would come with the overflow, take the count after
+    if ((t1_5Counts & 0xFF) == 0)
+        t1_5Counts++;
+    if ((t3_5Counts & 0xFF) == 0)
+        t3_5Counts++;
+    TIMSK2 = 0;
+    TCCR2A = 0; // normal mode, the compare outputs disconnected
+    TCCR2B = select + 1;
+    OCR2A = t1_5Counts & 0xFF;
+    OCR2B = t3_5Counts & 0xFF;
+    t1_5Wraps = t1_5Counts >> 8;
+    t3_5Wraps = t3_5Counts >> 8;
+#endif
+}
+
+void modbus_autobaud(const long* bauds, unsigned char count, unsigned int dwell)
+{
+    autoBauds = bauds;
+    autoBaudCount = count;
+    autoBaudIndex = 0;
+    autoBaudDwell = dwell;
+    autoBaudListen();
+}
+
+long modbus_baud()
+{
+    return autoBauds ? 0 : baudRate;
+}
+
+// whether frame[] is a request or a response of function 3, 6 or 16
+// of the length it should have, the CRC aside
+unsigned char lockableFrame(unsigned int buffer)
+{
+    unsigned char code = frame[1] & 0x7F;
+    if (code != 3 && code != 6 && code != 16)
+        return 0;
+    if (frame[1] & 0x80)
+        return buffer == 5; // an exception response
+    if (buffer == 8)
+        return 1; // a request of function 3 or 6, a response of 6 or 16
+    if (code == 3)
+        return buffer == 5u + frame[2]; // a response
+    if (code == 16)
+        return buffer == 9u + frame[6]; // a request
+    return 0;
+}
+
+void modbus_configure_port(unsigned int config)
+{
+    portConfig = config;
+    if (baudRate)
+        beginPort(baudRate);
+}
+
+// listen at the candidate autoBaudIndex with the timing re-derived for it
+void autoBaudListen()
+{
+    beginPort(autoBauds[autoBaudIndex]);
+    modbus_configure_timing(timingProfile, timingBits, T1_5, T3_5);
+    foreignFrame = 0;
+    autoBaudStart = millis();
+}
+
+void beginPort(long baud)
+{
+    baudRate = baud;
+#if MODBUS_ISR_RX && defined(__AVR__)
+    // USART0 is driven here and not through Serial, whose interrupt
+    // would clash with the one below, at double speed like the core.
+    // The core's SERIAL_8N1 etc. are the bits of UCSR0C.
+    UCSR0A = _BV(U2X0);
+    UBRR0 = (F_CPU / 4 / baud - 1) / 2;
+    UCSR0C = portConfig;
+    UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+#else
+    Serial.begin(baud, portConfig);
+#endif
+}
+
+unsigned int calculateCRC(unsigned int bufferSize)
+{
+    unsigned int temp, temp2;
+    temp = 0xFFFF;
+    for (unsigned int i = 0; i < bufferSize; i++)
+        temp = crcByte(temp, frame[i]);
+    // Reverse byte order.
+    temp2 = temp >> 8;
+    temp = (temp << 8) | temp2;
+    temp &= 0xFFFF;
+    return temp; // the returned value is already swopped - crcLo byte is first & crcHi byte is last
+}
+
+// one byte more of a CRC, not swopped
+unsigned int crcByte(unsigned int crc, unsigned char c)
+{
+    crc = crc ^ c;
+    for (unsigned char j = 1; j <= 8; j++) {
+        unsigned int flag = crc & 0x0001;
+        crc >>= 1;
+        if (flag)
+            crc ^= 0xA001;
+    }
+    return crc;
+}
+
+void sendPacket(unsigned int bufferSize)
+{
+    txBegin();
+    for (unsigned int i = 0; i < bufferSize; i++)
+        txByte(frame[i]);
+    txEnd(bufferSize);
+}
+
+void txBegin()
+{
+    // the response starts after the frame delay that ends the request,
+    // a listener on the line would take the two for one frame otherwise
+#if MODBUS_ISR_RX
+    while (rxState == RX_GAP)
+        delayMicroseconds(RX_POLL); // until the timer marks T3.5
+#else
+    unsigned long quiet = micros() - lineQuiet;
+    if (quiet < T3_5)
+        delayMicroseconds(T3_5 - quiet);
+#endif
+
+    if (TxEnablePin > 1)
+        digitalWrite(TxEnablePin, HIGH);
+
+#if MODBUS_ISR_RX && defined(__AVR__)
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0); // clear the transmit complete flag
+#endif
+}
+
+void txByte(unsigned char c)
+{
+#if MODBUS_ISR_RX && defined(__AVR__)
+    while (!(UCSR0A & _BV(UDRE0)))
+        ;
+    UDR0 = c;
+#else
+    Serial.write(c);
+#endif
+}
+
+// the frame in frame[] has been handed to txByte(), wait for it to go out
+void txEnd(unsigned int bufferSize)
+{
+#if MODBUS_ISR_RX && defined(__AVR__)
+    while (!(UCSR0A & _BV(TXC0)))
+        ; // the last stop bit is out
+#else
+    Serial.flush();
+#endif
+    TRACE_FRAME(bufferSize, TRACE_TX);
+    (void)bufferSize; // without the trace
+
+    if (TxEnablePin > 1)
+        digitalWrite(TxEnablePin, LOW);
+}
+
+void modbus_trace_dump(Stream* port)
+{
+#if MODBUS_TRACE_DEPTH
+    // start with the oldest record
+    unsigned char index = (traceNext + MODBUS_TRACE_DEPTH - traceCount) % MODBUS_TRACE_DEPTH;
+
+    port->write(traceCount);
+    for (unsigned char i = 0; i < traceCount; i++) {
+        TraceRecord* record = &trace[index];
+        unsigned char dataSize = record->length < MODBUS_TRACE_BYTES ? record->length : MODBUS_TRACE_BYTES;
+        port->write((unsigned char)(record->time >> 24));
+        port->write((unsigned char)(record->time >> 16));
+        port->write((unsigned char)(record->time >> 8));
+        port->write((unsigned char)record->time);
+        port->write(record->info);
+        port->write(record->length);
+        port->write(record->data, dataSize);
+
+        if (++index == MODBUS_TRACE_DEPTH)
+            index = 0;
+    }
+#else
+    (void)port;
+#endif
+}
+
+#if MODBUS_ISR_RX
+// a byte from the receive interrupt, error is set for a framing,
+// parity or overrun error
+void modbus_rx_byte(unsigned char c, unsigned char error)
+{
+    if (rxState != RX_FRAME) {
+        // a new frame, which is broken when it starts less than T3.5
+        // after the last one
+        rxLength = 0;
+        rxStatus = rxState == RX_GAP ? RX_ERROR : RX_OK;
+        rxDrop = (unsigned char)(rxHead - rxTail) == MODBUS_RX_FRAMES;
+        rxState = RX_FRAME;
+    }
+    rxTimerStart();
+
+    if (rxDrop)
+        return;
+    if (rxLength == 0 && !autoBauds && c != slaveID && c != 0) {
+        rxDrop = 1; // for another slave, kept while hunting for the baud rate
+        return;
+    }
+    if (error)
+        rxStatus = RX_ERROR;
+    if (rxLength == BUFFER_SIZE) {
+        rxStatus = RX_ERROR; // overflow
+        return;
+    }
+    rxQueue[rxHead % MODBUS_RX_FRAMES].data[rxLength++] = c;
+}
+
+// T1.5 after the last byte, the frame has ended
+void modbus_rx_t1_5()
+{
+    if (rxState != RX_FRAME)
+        return;
+    rxState = RX_GAP;
+    if (rxDrop)
+        return;
+
+    RxFrame* received = &rxQueue[rxHead % MODBUS_RX_FRAMES];
+    received->length = rxLength;
+    received->status = rxStatus;
+    rxHead++; // hands the frame to modbus_update()
+}
+
+// T3.5 after the last byte, the next byte starts a frame
+void modbus_rx_t3_5()
+{
+    if (rxState == RX_GAP)
+        rxState = RX_IDLE;
+}
+
+#ifdef __AVR__
+void rxTimerStart()
+{
+    TCNT2 = 0;
+    rxTimerWraps = 0;
+    TIFR2 = _BV(OCF2A) | _BV(OCF2B) | _BV(TOV2); // forget matches of the last byte
+    TIMSK2 = _BV(OCIE2A) | _BV(OCIE2B) | (t3_5Wraps ? _BV(TOIE2) : 0);
+}
+
+#if defined(USART_RX_vect)
+ISR(USART_RX_vect)
+#elif defined(USART0_RX_vect)
+ISR(USART0_RX_vect)
+#else
+#error "MODBUS_ISR_RX needs a board with USART0"
+#endif
+{
+    unsigned char error = UCSR0A & (_BV(FE0) | _BV(DOR0) | _BV(UPE0)); // before UDR0 is read
+    modbus_rx_byte(UDR0, error);
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+    if (rxTimerWraps != t1_5Wraps)
+        return; // due after another overflow
+    TIMSK2 &= ~_BV(OCIE2A);
+    modbus_rx_t1_5();
+}
+
+ISR(TIMER2_COMPB_vect)
+{
+    if (rxTimerWraps != t3_5Wraps)
+        return;
+    TIMSK2 = 0; // until the next byte
+    modbus_rx_t3_5();
+}
+
+ISR(TIMER2_OVF_vect)
+{
+    rxTimerWraps++;
+}
+#else
+void rxTimerStart()
+{
+    modbus_rx_timer_start(T1_5, T3_5);
+}
+#endif
+#endif
+
+#if MODBUS_TRACE_DEPTH
+// record the first bytes of frame[] in the trace, overwriting the oldest record when full
+void traceFrame(unsigned int length, unsigned char info)
+{
+    TraceRecord* record = &trace[traceNext];
+    record->time = micros();
+    record->info = info;
+    record->length = length > 255 ? 255 : length;
+    memcpy(record->data, frame, length < MODBUS_TRACE_BYTES ? length : MODBUS_TRACE_BYTES);
+
+    if (++traceNext == MODBUS_TRACE_DEPTH)
+        traceNext = 0;
+    if (traceCount < MODBUS_TRACE_DEPTH)
+        traceCount++;
+}
+
+// set the outcome of the most recent record once the frame has been checked
+void traceOutcome(unsigned char info)
+{
+    trace[(traceNext ? traceNext : MODBUS_TRACE_DEPTH) - 1].info = info;
+}
+#endif
+
@@ -1,89 +1,265 @@
-#ifndef SIMPLE_MODBUS_SLAVE_H
-#define SIMPLE_MODBUS_SLAVE_H
-
-/*
-  SimpleModbusSlave allows you to communicate
-  to any slave using the Modbus RTU protocol.
-  
-  The crc calculation is based on the work published
-  by jpmzometa at
-  http://sites.google.com/site/jpmzometa/arduino-mbrt
-  
-  By Juan Bester : bester.juan@gmail.com
-  
-  The functions implemented are functions 3 and 16.
-  read holding registers and preset multiple registers
-  of the Modbus RTU Protocol, to be used over the Arduino serial connection.
-  
-  This implementation DOES NOT fully comply with the Modbus specifications.
-  
-  Specifically the frame time out have not been implemented according
-  to Modbus standards. The code does however combine the check for
-  inter character time out and frame time out by incorporating a maximum
-  time out allowable when reading from the message stream.
-  
-  These library of functions are designed to enable a program send and
-  receive data from a device that communicates using the Modbus protocol.
-  
-  SimpleModbusSlave implements an unsigned int return value on a call to modbus_update().
-  This value is the total error count since the slave started. It's useful for fault finding.
-  
-  This code is for a Modbus slave implementing functions 3 and 16
-  function 3: Reads the binary contents of holding registers (4X references)
-  function 16: Presets values into a sequence of holding registers (4X references)
-  
-  All the functions share the same register array.
-  
-  Exception responses:
-  1 ILLEGAL FUNCTION
-  2 ILLEGAL DATA ADDRESS
-  3 ILLEGAL DATA VALUE
-  
-  Note:
-  The Arduino serial ring buffer is 128 bytes or 64 registers.
-  Most of the time you will connect the arduino to a master via serial
-  using a MAX485 or similar.
-  
-  In a function 3 request the master will attempt to read from your
-  slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-  and two BYTES CRC the master can only request 122 bytes or 61 registers.
-  
-  In a function 16 request the master will attempt to write to your
-  slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
-  NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-  118 bytes or 59 registers.
-  
-  Using the FTDI converter ic the maximum bytes you can send is limited
-  to its internal buffer which is 60 bytes or 30 unsigned int registers.
-  
-  Thus:
-  
-  In a function 3 request the master will attempt to read from your
-  slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-  and two BYTES CRC the master can only request 54 bytes or 27 registers.
-  
-  In a function 16 request the master will attempt to write to your
-  slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
-  NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-  50 bytes or 25 registers.
-  
-  Since it is assumed that you will mostly use the Arduino to connect to a
-  master without using a USB to Serial converter the internal buffer is set
-  the same as the Arduino Serial ring buffer which is 128 bytes.
-  
-  The functions included here have been derived from the
-  Modbus Specifications and Implementation Guides
-  
-  http://www.modbus.org/docs/Modbus_over_serial_line_V1_02.pdf
-  http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b.pdf
-  http://www.modbus.org/docs/PI_MBUS_300.pdf
-*/
-
-#include "Arduino.h"
-
-// function definitions
-void modbus_configure(long baud, byte _slaveID, byte _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency);
-unsigned int modbus_update(unsigned int *holdingRegs);
-
-
-#endif
+#ifndef SIMPLE_MODBUS_SLAVE_H
+#define SIMPLE_MODBUS_SLAVE_H
+
+/*
+  SimpleModbusSlave allows you to communicate
+  to any slave using the Modbus RTU protocol.
+  
+  The crc calculation is based on the work published
+  by jpmzometa at
+  http://sites.google.com/site/jpmzometa/arduino-mbrt
+  
+  By Juan Bester : bester.juan@gmail.com
+  
+  The functions implemented are functions 3 and 16.
+  read holding registers and preset multiple registers
+  of the Modbus RTU Protocol, to be used over the Arduino serial connection.
+  
+  This implementation DOES NOT fully comply with the Modbus specifications.
+  
+  Specifically the frame time out have not been implemented according
+  to Modbus standards. The code does however combine the check for
+  inter character time out and frame time out by incorporating a maximum
+  time out allowable when reading from the message stream.
+  
+  These library of functions are designed to enable a program send and
+  receive data from a device that communicates using the Modbus protocol.
+  
+  SimpleModbusSlave implements an unsigned int return value on a call to modbus_update().
+  This value is the total error count since the slave started. It's useful for fault finding.
+  
+  This code is for a Modbus slave implementing functions 3 and 16
+  function 3: Reads the binary contents of holding registers (4X references)
+  function 16: Presets values into a sequence of holding registers (4X references)
+  
+  All the functions share the same register array.
+  
+  Exception responses:
+  1 ILLEGAL FUNCTION
+  2 ILLEGAL DATA ADDRESS
+  3 ILLEGAL DATA VALUE
+  
+  Choosing the functions
+  Every function handler costs flash whether the master uses it
+  or not. Set MODBUS_FUNCTION_3, MODBUS_FUNCTION_6 or
+  MODBUS_FUNCTION_16 to 0 with a compiler flag to leave that
+  handler out, the slave then answers it with exception 1 like
+  any other function it doesn't know. When the size of the
+  register array never changes set MODBUS_HOLDING_REGS_SIZE to
+  it, the range checks then compare against a constant and the
+  size passed to modbus_configure() is ignored.
+  
+  Frame tracing
+  For post-mortem analysis the last MODBUS_TRACE_DEPTH frames
+  can be kept in a ring buffer. The trace is compiled out when
+  MODBUS_TRACE_DEPTH is 0 (the default), set it with a compiler
+  flag e.g. -DMODBUS_TRACE_DEPTH=8. Only the first
+  MODBUS_TRACE_BYTES bytes of each frame are kept.
+  modbus_trace_dump() writes the trace, oldest frame first, to
+  another port in this binary layout:
+  1 byte  - number of records
+  and for every record:
+  4 bytes - micros() when the frame was handled, Hi byte first
+  1 byte  - TRACE_TX for a transmitted frame ORed with the outcome
+  1 byte  - length of the frame on the line
+  n bytes - the frame, n = min(length, MODBUS_TRACE_BYTES)
+  Frames addressed to other slaves are not traced.
+  
+  Frame timing
+  T1.5, the silence that ends a frame, and T3.5, the silence
+  between two frames, follow from the time of one character: a
+  start bit, the data bits, the parity bit if any and the stop
+  bits at the baud rate. modbus_configure() picks TIMING_SPEC for
+  10 bit characters (8N1), or TIMING_FAST when _lowLatency is
+  set. Choose another profile afterwards with
+  modbus_configure_timing(profile, bits per character, T1.5 us,
+  T3.5 us):
+  TIMING_SPEC   1.5 and 3.5 characters, or the fixed 750 us and
+                1750 us the spec asks for above 19200 baud
+  TIMING_FAST   1.5 and 3.5 characters at every baud rate, e.g.
+                130 us and 304 us at 115200 baud 8N1
+  TIMING_CUSTOM the T1.5 and T3.5 given, in microseconds
+  The times given are only used by TIMING_CUSTOM. The bits per
+  character only enter the timing. Called before
+  modbus_configure() or with 0 bits per character it does
+  nothing.
+  
+  The port is set up for 8N1. For another format, e.g. the 8E1
+  of the spec, call modbus_configure_port(SERIAL_8E1) before or
+  after modbus_configure() and give modbus_configure_timing() its
+  11 bits per character. The format is kept when the port is
+  started again, at every candidate rate of modbus_autobaud() too.
+  Don't call Serial.begin() yourself, the next restart would undo
+  it and in MODBUS_ISR_RX mode Serial isn't used at all.
+  
+  Finding the baud rate
+  A slave moved to a line with another baud rate can find it on
+  its own: after modbus_configure() call
+  modbus_autobaud(bauds, count, dwell) with the candidate rates,
+  e.g.
+    const long bauds[] = { 9600, 19200, 38400, 57600, 115200 };
+    modbus_autobaud(bauds, 5, 500);
+  modbus_update() then listens dwell ms at each rate in turn,
+  around and around, and stays at the first one a frame arrives
+  at, for this slave or any other, that is a request or response
+  of function 3, 6 or 16 of the length it should have and with a
+  valid CRC. T1.5 and T3.5
+  are re-derived for every rate with the profile and bits per
+  character last given to modbus_configure_timing(). dwell has to
+  cover the longest gap between two frames of the master plus a
+  frame. modbus_baud() returns the rate found, 0 while hunting,
+  e.g. to keep it in EEPROM for the next start. Frames heard
+  while hunting are neither answered nor counted as errors, apart
+  from the one locked on. The array has to stay valid while
+  hunting.
+  The checks make a lock on garbage unlikely, not impossible: at
+  a wrong rate the CRC alone passes about one frame in 65536, and
+  a slave locked at a wrong rate stays there. A sketch can call
+  modbus_autobaud() again when the error count modbus_update()
+  returns keeps rising.
+  
+  Frames for other slaves
+  On a line with many slaves most frames are for someone else.
+  The slave looks at the first byte of a frame only: if it is
+  neither its own id nor the broadcast id the rest of the frame
+  is read and dropped as it arrives, over as many calls to
+  modbus_update() as it takes, without being buffered, checked
+  or waited on. Such frames are not counted as errors.
+  
+  Receiving in interrupts
+  modbus_update() normally reads the frame from Serial when it is
+  called and times the gaps between bytes with delays, so a long
+  loop() lets frames run together in the serial buffer. With
+  MODBUS_ISR_RX set to 1 every byte is taken in the USART0 receive
+  interrupt and timer 2 is restarted on it, its compare matches
+  mark T1.5 (end of frame) and T3.5 (line idle) after the last
+  byte (below about 2400 baud its overflows are counted too).
+  Complete frames wait in a queue of MODBUS_RX_FRAMES
+  frames until modbus_update() answers them, one per call, so
+  the frame boundaries hold whatever the loop does. A frame
+  continuing after T1.5 and a byte with a framing, parity or
+  overrun error make the frame a buffer error, a frame arriving
+  with the queue full is dropped. Frames for other slaves are
+  dropped in the interrupt.
+  The library then drives USART0 and timer 2 itself: the sketch
+  must not use Serial, tone() or PWM on pins 3 and 11 (Uno)
+  or 9 and 10 (Mega), and the queue costs
+  MODBUS_RX_FRAMES * MODBUS_BUFFER_SIZE bytes of RAM. A frame is
+  answered in its queue slot, there is no other frame buffer.
+  On boards other than the AVR ones call modbus_rx_byte() from
+  the receive interrupt, and provide modbus_rx_timer_start() to
+  restart a timer that calls modbus_rx_t1_5() and
+  modbus_rx_t3_5() the given microseconds later.
+  
+  Note:
+  A frame holds up to MODBUS_BUFFER_SIZE bytes, 128 by default,
+  so a master can read 61 and write 59 registers in one request.
+  Set it to 256 with a compiler flag for the longest RTU frame, a
+  function 3 response of 125 registers or a function 16 request
+  of 123 registers, at the cost of another 128 bytes of RAM.
+  Reads that don't fit are answered with exception 3.
+  
+  The serial ring buffer of the Arduino core is 64 bytes on most
+  boards, the bytes of a longer request are lost when the sketch
+  doesn't call modbus_update() before it fills (5.5 ms at 115200
+  baud). With MODBUS_ISR_RX (see "Receiving in interrupts") the
+  frames are received into buffers of MODBUS_BUFFER_SIZE bytes
+  owned by the library instead, however long loop() takes.
+  
+  Using the FTDI converter ic the maximum bytes you can send is limited
+  to its internal buffer which is 60 bytes or 30 unsigned int registers.
+  
+  Thus:
+  
+  In a function 3 request the master will attempt to read from your
+  slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
+  and two BYTES CRC the master can only request 54 bytes or 27 registers.
+  
+  In a function 16 request the master will attempt to write to your
+  slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
+  NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
+  50 bytes or 25 registers.
+  
+  The functions included here have been derived from the
+  Modbus Specifications and Implementation Guides
+  
+  http://www.modbus.org/docs/Modbus_over_serial_line_V1_02.pdf
+  http://www.modbus.org/docs/Modbus_Application_Protocol_V1_1b.pdf
+  http://www.modbus.org/docs/PI_MBUS_300.pdf
+*/
+
+#include "Arduino.h"
+
+#ifndef MODBUS_FUNCTION_3
+#define MODBUS_FUNCTION_3 1 // read holding registers
+#endif
+
+#ifndef MODBUS_FUNCTION_6
+#define MODBUS_FUNCTION_6 1 // preset single register
+#endif
+
+#ifndef MODBUS_FUNCTION_16
+#define MODBUS_FUNCTION_16 1 // preset multiple registers
+#endif
+
+#ifndef MODBUS_HOLDING_REGS_SIZE
+#define MODBUS_HOLDING_REGS_SIZE 0 // fixed size of the register array, 0 takes it from modbus_configure()
+#endif
+
+#ifndef MODBUS_BUFFER_SIZE
+#define MODBUS_BUFFER_SIZE 128 // longest frame received or sent, up to 256
+#endif
+
+#ifndef MODBUS_ISR_RX
+#define MODBUS_ISR_RX 0 // receive in the USART interrupt, 0 reads Serial in modbus_update()
+#endif
+
+#ifndef MODBUS_RX_FRAMES
+#define MODBUS_RX_FRAMES 2 // received frames waiting for modbus_update(), a power of two
+#endif
+
+#ifndef MODBUS_TRACE_DEPTH
+#define MODBUS_TRACE_DEPTH 0 // number of frames kept in the trace, 0 disables it
+#endif
+
+#ifndef MODBUS_TRACE_BYTES
+#define MODBUS_TRACE_BYTES 16 // bytes kept of each traced frame
+#endif
+
+// frame timing profiles
+#define TIMING_SPEC 0
+#define TIMING_FAST 1
+#define TIMING_CUSTOM 2
+
+// trace record outcomes
+#define TRACE_OK 0
+#define TRACE_TIMEOUT 1
+#define TRACE_BUFFER_ERROR 2
+#define TRACE_INCORRECT_ID 3
+#define TRACE_INCORRECT_FUNCTION 4
+#define TRACE_INCORRECT_BYTES 5
+#define TRACE_CHECKSUM_FAILED 6
+#define TRACE_EXCEPTION 7
+#define TRACE_TX 0x80 // set on frames that were transmitted
+
+// function definitions
+void modbus_configure(long baud, byte _slaveID, byte _TxEnablePin, unsigned int _holdingRegsSize, unsigned char _lowLatency);
+unsigned int modbus_update(unsigned int *holdingRegs);
+void modbus_configure_timing(unsigned char profile, unsigned char bitsPerChar, unsigned int t1_5, unsigned int t3_5);
+void modbus_autobaud(const long* bauds, unsigned char count, unsigned int dwell);
+long modbus_baud();
+void modbus_configure_port(unsigned int config);
+void modbus_trace_dump(Stream* port);
+
+#if MODBUS_ISR_RX
+// interrupt side of the receiver, see "Receiving in interrupts"
+void modbus_rx_byte(unsigned char c, unsigned char error);
+void modbus_rx_t1_5();
+void modbus_rx_t3_5();
+#ifndef __AVR__
+void modbus_rx_timer_start(unsigned int t1_5, unsigned int t3_5); // provided by the sketch
+#endif
+#endif
+
+
+#endif
@@ -11,18 +11,10 @@
    The modbus_update() method updates the holdingRegs register array and checks communication.
 
    Note:
-   The Arduino serial ring buffer is 128 bytes or 64 registers.
-   Most of the time you will connect the arduino to a master via serial
-   using a MAX485 or similar.
-
-   In a function 3 request the master will attempt to read from your
-   slave and since 5 bytes is already used for ID, FUNCTION, NO OF BYTES
-   and two BYTES CRC the master can only request 122 bytes or 61 registers.
-
-   In a function 16 request the master will attempt to write to your
-   slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
-   NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
-   118 bytes or 59 registers.
+   The library's frame buffer is 128 bytes (MODBUS_BUFFER_SIZE), so the
+   master can read 61 and write 59 registers in one request. Build with
+   MODBUS_BUFFER_SIZE 256 for the longest modbus frame: a function 3
+   response of 125 registers or a function 16 request of 123 registers.
 
    Using the FTDI USB to Serial converter the maximum bytes you can send is limited
    to its internal buffer which is 60 bytes or 30 unsigned int registers.
@@ -37,10 +29,6 @@
    slave and since a 9 bytes is already used for ID, FUNCTION, ADDRESS,
    NO OF REGISTERS, NO OF BYTES and two BYTES CRC the master can only write
    50 bytes or 25 registers.
-
-   Since it is assumed that you will mostly use the Arduino to connect to a
-   master without using a USB to Serial converter the internal buffer is set
-   the same as the Arduino Serial ring buffer which is 128 bytes.
 */
 
 
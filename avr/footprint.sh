@@ -0,0 +1,86 @@
+#!/bin/sh
+# Flash and RAM footprint of the library examples on AVR boards.
+#
+# Builds every configuration in footprint.conf with arduino-cli,
+# which brings avr-gcc along with the board cores, and prints the
+# text, data and bss bytes of each as a table. flash is text + data,
+# ram is data + bss (without the stack). Keep the table of one
+# revision with -o and pass it to -c in another to see what changed.
+#
+# usage: avr/footprint.sh [-f conf] [-o table] [-c old table]
+
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+root=$(dirname "$here")
+conf=$here/footprint.conf
+out=
+old=
+
+while getopts f:o:c: option; do
+    case $option in
+    f) conf=$OPTARG ;;
+    o) out=$OPTARG ;;
+    c) old=$OPTARG ;;
+    *) echo "usage: $0 [-f conf] [-o table] [-c old table]" >&2; exit 2 ;;
+    esac
+done
+
+ARDUINO_CLI=${ARDUINO_CLI:-arduino-cli}
+if ! command -v "$ARDUINO_CLI" > /dev/null; then
+    echo "$0: $ARDUINO_CLI not found, set ARDUINO_CLI" >&2
+    exit 1
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+table=$work/table
+printf '%-24s %7s %7s %7s %7s %7s\n' configuration text data bss flash ram > "$table"
+
+grep -v '^[[:space:]]*\(#\|$\)' "$conf" | while read -r name fqbn library example flags; do
+    sketch=$root/$library/examples/$example
+    build=$work/$name
+
+    if ! "$ARDUINO_CLI" compile --fqbn "$fqbn" --library "$root/$library" --build-path "$build" \
+            --build-property "compiler.cpp.extra_flags=$flags" "$sketch" > "$build.log" 2>&1; then
+        echo "$name: build failed" >&2
+        cat "$build.log" >&2
+        printf '%-24s %7s %7s %7s %7s %7s\n' "$name" - - - - - >> "$table"
+        continue
+    fi
+
+    # avr-size of the toolchain that built it, else the one on the PATH
+    size=${AVR_SIZE:-}
+    if [ -z "$size" ]; then
+        tools=$("$ARDUINO_CLI" compile --fqbn "$fqbn" --show-properties "$sketch" 2> /dev/null |
+                sed -n 's/^runtime\.tools\.avr-gcc\.path=//p' | head -n 1)
+        size=avr-size
+        [ -x "$tools/bin/avr-size" ] && size=$tools/bin/avr-size
+    fi
+
+    "$size" "$build/$example.ino.elf" | awk -v name="$name" 'NR == 2 {
+        printf "%-24s %7d %7d %7d %7d %7d\n", name, $1, $2, $3, $1 + $2, $2 + $3
+    }' >> "$table"
+done
+
+cat "$table"
+[ -n "$out" ] && cp "$table" "$out"
+
+if [ -n "$old" ]; then
+    echo
+    echo "change against $old:"
+    awk 'NR == FNR {
+             if (FNR > 1)
+                 before[$1] = $0
+             next
+         }
+         FNR > 1 && ($1 in before) {
+             split(before[$1], b)
+             if ($2 == "-" || b[2] == "-") {
+                 if ($2 != b[2])
+                     printf "%-24s %s\n", $1, $2 == "-" ? "build failed" : "builds again"
+             } else if ($2 != b[2] || $3 != b[3] || $4 != b[4])
+                 printf "%-24s %+7d %+7d %+7d %+7d %+7d\n", $1, $2 - b[2], $3 - b[3], $4 - b[4], $5 - b[5], $6 - b[6]
+         }' "$old" "$table"
+fi
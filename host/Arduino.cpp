@@ -0,0 +1,133 @@
+#include "Arduino.h"
+#include "Clock.h"
+#include "SerialBackend.h"
+
+#include <time.h>
+
+static uint8_t pinState[256];
+
+// counts from the start of the program, like a board counts from reset
+class MonotonicClock : public Clock
+{
+public:
+    MonotonicClock() : start(monotonic()) {}
+
+    unsigned long long now() { return monotonic() - start; }
+
+    void sleep(unsigned long long us)
+    {
+        struct timespec duration;
+        duration.tv_sec = us / 1000000;
+        duration.tv_nsec = (us % 1000000) * 1000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, 0, &duration, &duration) != 0)
+            ; // interrupted, sleep the rest
+    }
+
+private:
+    static unsigned long long monotonic()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    }
+
+    unsigned long long start;
+};
+
+static MonotonicClock systemClock;
+static Clock* activeClock = &systemClock;
+
+void setClock(Clock* _clock)
+{
+    activeClock = _clock ? _clock : &systemClock;
+}
+
+// unsigned long is 64 bits on the host, so unlike on a board these
+// don't wrap around (the library code handles both)
+unsigned long millis()
+{
+    return (unsigned long)(activeClock->now() / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)activeClock->now();
+}
+
+void delay(unsigned long ms)
+{
+    activeClock->sleep((unsigned long long)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    activeClock->sleep(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    pinState[pin] = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pinState[pin];
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+        n += write(*buffer++);
+    return n;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    if (backend)
+        backend->begin(baud);
+}
+
+void HardwareSerial::begin(unsigned long baud, uint8_t config)
+{
+    (void)config; // a backend carries bytes, parity and stop bits don't reach it
+    begin(baud);
+}
+
+void HardwareSerial::end()
+{
+    if (backend)
+        backend->end();
+}
+
+int HardwareSerial::available()
+{
+    return backend ? backend->available() : 0;
+}
+
+int HardwareSerial::read()
+{
+    return backend ? backend->read() : -1;
+}
+
+int HardwareSerial::peek()
+{
+    return backend ? backend->peek() : -1;
+}
+
+void HardwareSerial::flush()
+{
+    if (backend)
+        backend->flush();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return backend ? backend->write(c) : 0;
+}
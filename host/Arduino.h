@@ -0,0 +1,93 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+/*
+  Minimal Arduino core for host builds.
+
+  Provides just enough of the Arduino API for the SimpleModbus
+  libraries to compile and run on a POSIX system: timing,
+  digital pins (which are only remembered, there is no hardware
+  behind them) and a HardwareSerial that forwards to a
+  SerialBackend, e.g. a termios port (see PosixSerial.h).
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+// serial frame formats, the AVR core's values
+#define SERIAL_8N1 0x06
+#define SERIAL_8N2 0x0E
+#define SERIAL_8E1 0x26
+#define SERIAL_8E2 0x2E
+#define SERIAL_8O1 0x36
+#define SERIAL_8O2 0x3E
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+class SerialBackend;
+
+class HardwareSerial : public Stream
+{
+public:
+    HardwareSerial() : backend(0) {}
+
+    // the backend has to be attached before begin()
+    void attach(SerialBackend* _backend) { backend = _backend; }
+    SerialBackend* attached() const { return backend; }
+
+    void begin(unsigned long baud);
+    void begin(unsigned long baud, uint8_t config); // config is not applied
+    void end();
+    int available();
+    int read();
+    int peek();
+    void flush();
+    size_t write(uint8_t c);
+    using Print::write;
+
+    operator bool() const { return backend != 0; }
+
+private:
+    SerialBackend* backend;
+};
+
+// There is no global Serial, the host wrapper of each library
+// (e.g. SimpleModbusMasterHost.h) declares the one it uses.
+
+#endif
@@ -0,0 +1,97 @@
+#include "AsyncMaster.h"
+
+AsyncMaster::Transaction::Transaction(AsyncMaster* _master, unsigned char _id, unsigned char _function,
+                                      unsigned int _address, unsigned int _count, const unsigned int* _values)
+    : master(_master), id(_id), function(_function), address(_address), count(_count),
+      values(_values), next(0)
+{
+    response.status = BUS_PENDING;
+    response.exception = 0;
+
+    // a count the frame can't carry never goes on the bus
+    unsigned int maxCount = function == READ_HOLDING_REGISTERS ? BUS_MAX_READ_REGISTERS : BUS_MAX_WRITE_REGISTERS;
+    if (count < 1 || count > maxCount)
+        response.status = BUS_ERROR;
+}
+
+void AsyncMaster::Transaction::await_suspend(std::coroutine_handle<> handle)
+{
+    waiting = handle;
+    if (master->tail)
+        master->tail->next = this;
+    else
+        master->head = this;
+    master->tail = this;
+
+    if (!master->current)
+        master->start();
+}
+
+AsyncMaster::AsyncMaster(MasterBus& _bus)
+    : bus(_bus), head(0), tail(0), current(0)
+{
+}
+
+AsyncMaster::~AsyncMaster()
+{
+    // the awaiters live in the frames, take the link before destroying one
+    if (current)
+        current->waiting.destroy();
+    while (head) {
+        Transaction* transaction = head;
+        head = head->next;
+        transaction->waiting.destroy();
+    }
+}
+
+AsyncMaster::Transaction AsyncMaster::read_holding(unsigned char id, unsigned int address, unsigned int count)
+{
+    return Transaction(this, id, READ_HOLDING_REGISTERS, address, count, 0);
+}
+
+AsyncMaster::Transaction AsyncMaster::write_multiple(unsigned char id, unsigned int address,
+                                                     unsigned int count, const unsigned int* values)
+{
+    return Transaction(this, id, PRESET_MULTIPLE_REGISTERS, address, count, values);
+}
+
+void AsyncMaster::start()
+{
+    current = head;
+    head = head->next;
+    if (!head)
+        tail = 0;
+
+    if (current->function == READ_HOLDING_REGISTERS) {
+        current->response.registers.resize(current->count);
+        bus.start(current->id, current->function, current->address, current->count,
+                  current->response.registers.data());
+    } else {
+        // the library only reads the array of a write
+        bus.start(current->id, current->function, current->address, current->count,
+                  const_cast<unsigned int*>(current->values));
+    }
+}
+
+void AsyncMaster::poll()
+{
+    if (!current)
+        return;
+
+    int result = bus.poll();
+    if (result == BUS_PENDING)
+        return;
+
+    Transaction* done = current;
+    current = 0;
+    done->response.status = result;
+    done->response.exception = bus.exception();
+    if (result != BUS_OK)
+        done->response.registers.clear();
+
+    // the coroutine may queue its next transaction, or end and free done
+    done->waiting.resume();
+
+    if (!current && head)
+        start();
+}
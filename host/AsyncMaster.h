@@ -0,0 +1,107 @@
+#ifndef ASYNC_MASTER_H
+#define ASYNC_MASTER_H
+
+/*
+  Coroutine interface to the master core (C++20).
+
+  Instead of packets scanned forever, any number of coroutines
+  ask for single transactions and wait for their answers:
+
+    Task poller(AsyncMaster& master)
+    {
+        for (;;) {
+            Response response = co_await master.read_holding(2, 0, 9);
+            if (response.ok())
+                ...response.registers...
+        }
+    }
+
+  AsyncMaster queues the waiting coroutines in the order they
+  asked and runs their transactions one at a time through a
+  MasterBus, i.e. constructPacket() and checkResponse() of the
+  library. Call poll() from the loop, it drives the transaction
+  on the bus and resumes the coroutine whose transaction ended.
+  A waiting coroutine costs its frame and nothing else: the
+  queue links the awaiters in place, there is no allocation and
+  no thread per request. A count of 0 or above
+  BUS_MAX_READ_REGISTERS or BUS_MAX_WRITE_REGISTERS doesn't go
+  on the bus, the co_await returns BUS_ERROR at once.
+
+  Task is a coroutine type that starts at once and frees itself
+  when it returns. Destroying the AsyncMaster destroys the
+  coroutines still waiting on it.
+*/
+
+#include "MasterBus.h"
+
+#include <coroutine>
+#include <vector>
+
+struct Response {
+    int status; // BUS_OK, BUS_EXCEPTION, BUS_TIMEOUT or BUS_ERROR
+    unsigned char exception; // exception code with BUS_EXCEPTION
+    std::vector<unsigned int> registers; // the registers read
+
+    bool ok() const { return status == BUS_OK; }
+};
+
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { throw; } // to whoever resumed the coroutine
+    };
+};
+
+class AsyncMaster
+{
+public:
+    class Transaction
+    {
+    public:
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+        bool await_ready() const noexcept { return response.status != BUS_PENDING; }
+        void await_suspend(std::coroutine_handle<> handle);
+        Response await_resume() { return std::move(response); }
+
+    private:
+        friend class AsyncMaster;
+        Transaction(AsyncMaster* master, unsigned char id, unsigned char function,
+                    unsigned int address, unsigned int count, const unsigned int* values);
+
+        AsyncMaster* master;
+        unsigned char id;
+        unsigned char function;
+        unsigned int address;
+        unsigned int count;
+        const unsigned int* values; // registers to write
+        Response response;
+        std::coroutine_handle<> waiting;
+        Transaction* next;
+    };
+
+    explicit AsyncMaster(MasterBus& bus);
+    ~AsyncMaster();
+
+    Transaction read_holding(unsigned char id, unsigned int address, unsigned int count);
+    // values must stay valid until the transaction ends
+    Transaction write_multiple(unsigned char id, unsigned int address, unsigned int count,
+                               const unsigned int* values);
+
+    void poll();
+    bool idle() const { return !current && !head; }
+
+private:
+    void start();
+
+    MasterBus& bus;
+    Transaction* head; // waiting for the bus
+    Transaction* tail;
+    Transaction* current; // on the bus
+};
+
+#endif
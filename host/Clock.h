@@ -0,0 +1,18 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+// The time source behind millis(), micros(), delay() and
+// delayMicroseconds() on the host. Times are in microseconds.
+class Clock
+{
+public:
+    virtual ~Clock() {}
+    virtual unsigned long long now() = 0;
+    virtual void sleep(unsigned long long us) = 0;
+};
+
+// Run the Arduino timing functions on another clock, e.g. a
+// virtual one for simulation. 0 restores the system clock.
+void setClock(Clock* clock);
+
+#endif
@@ -0,0 +1,59 @@
+#include "MasterBus.h"
+
+using namespace modbus_master;
+
+void MasterBus::configure(long baud, unsigned int timeout)
+{
+    memset(&packet, 0, sizeof(packet));
+    // retries are counted per request here, the library must never give up on the packet
+    modbus_configure(baud, timeout, 0, 255, 0, &packet, 1);
+    active = false;
+}
+
+void MasterBus::start(unsigned char id, unsigned char function, unsigned int address,
+                      unsigned int count, unsigned int* registers)
+{
+    packet.id = id;
+    packet.function = function;
+    packet.address = address;
+    packet.no_of_registers = count;
+    packet.register_array = registers;
+    packet.retries = 0;
+    packet.connection = 1;
+    before = packet;
+    active = true;
+    exceptionCode = 0;
+
+    modbus_update(&packet); // sends the request
+}
+
+int MasterBus::poll()
+{
+    if (!active)
+        return BUS_PENDING;
+
+    modbus_update(&packet);
+
+    // the library counts a success, or a retry for any failure,
+    // when it becomes ready for the next transmission
+    if (packet.successful_requests != before.successful_requests) {
+        active = false;
+        return BUS_OK;
+    }
+    if (packet.retries == before.retries)
+        return BUS_PENDING;
+
+    active = false;
+    if (packet.timeout != before.timeout)
+        return BUS_TIMEOUT;
+
+    if (packet.illegal_function != before.illegal_function)
+        exceptionCode = 1;
+    else if (packet.illegal_data_address != before.illegal_data_address)
+        exceptionCode = 2;
+    else if (packet.illegal_data_value != before.illegal_data_value)
+        exceptionCode = 3;
+    else if (packet.misc_exceptions != before.misc_exceptions)
+        exceptionCode = 4; // the library doesn't keep the code, report a device failure
+    return exceptionCode ? BUS_EXCEPTION : BUS_ERROR;
+}
@@ -0,0 +1,57 @@
+#ifndef MASTER_BUS_H
+#define MASTER_BUS_H
+
+/*
+  One request at a time on top of the SimpleModbusMaster core.
+
+  The library scans a fixed packet array forever. MasterBus
+  keeps a single packet and only calls modbus_update() while a
+  request is outstanding, so each start() becomes exactly one
+  transaction built by constructPacket() and checked by
+  checkResponse(). The outcome is read back from the packet
+  counters once the library is ready for the next request.
+
+  The library keeps its state in globals, so there can only be
+  one MasterBus in a program.
+*/
+
+#include "SimpleModbusMasterHost.h"
+
+// poll() results
+#define BUS_PENDING 0
+#define BUS_OK 1
+#define BUS_EXCEPTION 2 // the slave answered with an exception, see exception()
+#define BUS_TIMEOUT 3
+#define BUS_ERROR 4 // a corrupted or unexpected response
+
+// BUFFER_SIZE of SimpleModbusMaster
+#define BUS_BUFFER_SIZE MODBUS_BUFFER_SIZE
+#define BUS_MAX_READ_REGISTERS ((BUS_BUFFER_SIZE - 5) / 2)
+#define BUS_MAX_WRITE_REGISTERS ((BUS_BUFFER_SIZE - 9) / 2)
+
+class MasterBus
+{
+public:
+    MasterBus() : active(false) {}
+
+    // timeout in ms, the polling delay is always 0
+    void configure(long baud, unsigned int timeout);
+
+    // function is READ_HOLDING_REGISTERS or PRESET_MULTIPLE_REGISTERS,
+    // registers is read into or written from and must stay valid
+    void start(unsigned char id, unsigned char function, unsigned int address,
+               unsigned int count, unsigned int* registers);
+    int poll();
+    bool busy() const { return active; }
+
+    // exception code of the last BUS_EXCEPTION result
+    unsigned char exception() const { return exceptionCode; }
+
+private:
+    modbus_master::Packet packet;
+    modbus_master::Packet before; // the counters at start()
+    bool active;
+    unsigned char exceptionCode;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "PacketMirror.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static uint64_t wallClock()
+{
+    timeval now;
+    gettimeofday(&now, 0);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static MirrorBlock* blockAt(const MirrorHeader* header, unsigned int n)
+{
+    return (MirrorBlock*)((char*)header + header->header_size + (size_t)n * header->block_size);
+}
+
+PacketMirror::PacketMirror()
+    : header(0), size(0), packets(0), totalNoOfPackets(0)
+{
+}
+
+PacketMirror::~PacketMirror()
+{
+    close();
+}
+
+bool PacketMirror::open(const char* path, modbus_master::Packet* _packets, unsigned int _totalNoOfPackets)
+{
+    close();
+
+    size = sizeof(MirrorHeader) + (size_t)_totalNoOfPackets * sizeof(MirrorBlock);
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, size) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    header = (MirrorHeader*)map;
+    packets = _packets;
+    totalNoOfPackets = _totalNoOfPackets;
+
+    // the file is zero filled, the magic goes in last so readers
+    // never see a header that isn't complete
+    header->version = MIRROR_VERSION;
+    header->block_count = totalNoOfPackets;
+    header->block_size = sizeof(MirrorBlock);
+    header->header_size = sizeof(MirrorHeader);
+    header->writer_pid = getpid();
+    header->created_us = wallClock();
+    __atomic_store_n(&header->magic, MIRROR_MAGIC, __ATOMIC_RELEASE);
+
+    update();
+    return true;
+}
+
+void PacketMirror::close()
+{
+    if (header)
+        munmap(header, size);
+    header = 0;
+}
+
+void PacketMirror::update()
+{
+    if (!header)
+        return;
+
+    for (unsigned int n = 0; n < totalNoOfPackets; n++) {
+        const modbus_master::Packet& packet = packets[n];
+        MirrorBlock* block = blockAt(header, n);
+
+        MirrorBlock next = *block;
+        next.id = packet.id;
+        next.function = packet.function;
+        next.connection = packet.connection;
+        next.address = packet.address;
+        next.no_of_registers = packet.no_of_registers;
+        next.requests = packet.requests;
+        next.successful_requests = packet.successful_requests;
+        next.total_errors = packet.total_errors;
+        next.retries = packet.retries;
+        next.timeout = packet.timeout;
+        next.incorrect_id_returned = packet.incorrect_id_returned;
+        next.incorrect_function_returned = packet.incorrect_function_returned;
+        next.incorrect_bytes_returned = packet.incorrect_bytes_returned;
+        next.checksum_failed = packet.checksum_failed;
+        next.buffer_errors = packet.buffer_errors;
+        next.illegal_function = packet.illegal_function;
+        next.illegal_data_address = packet.illegal_data_address;
+        next.illegal_data_value = packet.illegal_data_value;
+        next.misc_exceptions = packet.misc_exceptions;
+        unsigned int count = packet.no_of_registers < MIRROR_MAX_REGISTERS ? packet.no_of_registers : MIRROR_MAX_REGISTERS;
+        for (unsigned int i = 0; i < count; i++)
+            next.registers[i] = packet.register_array[i];
+
+        if (memcmp(&next, block, sizeof(next)) == 0)
+            continue; // nothing new, keep the sequence
+
+        uint32_t sequence = block->sequence;
+        next.updated_us = wallClock();
+        __atomic_store_n(&block->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE); // the odd sequence before the body
+        memcpy((char*)block + sizeof(uint32_t), (char*)&next + sizeof(uint32_t), sizeof(next) - sizeof(uint32_t));
+        __atomic_store_n(&block->sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+}
+
+bool mirror_read_block(const MirrorHeader* header, unsigned int n, MirrorBlock* copy)
+{
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != MIRROR_MAGIC ||
+        header->version != MIRROR_VERSION || n >= header->block_count)
+        return false;
+
+    const MirrorBlock* block = blockAt(header, n);
+    for (;;) {
+        uint32_t before = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue; // being written
+
+        memcpy(copy, block, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // the body before the check
+        if (__atomic_load_n(&block->sequence, __ATOMIC_RELAXED) == before) {
+            copy->sequence = before;
+            return true;
+        }
+    }
+}
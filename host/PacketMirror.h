@@ -0,0 +1,120 @@
+#ifndef PACKET_MIRROR_H
+#define PACKET_MIRROR_H
+
+/*
+  Shared memory mirror of the master's packets.
+
+  PacketMirror copies every Packet's registers, connection and
+  counters into a memory-mapped file (put it in /dev/shm to keep
+  it in RAM) so other processes on the box can read live values
+  with plain loads, without talking Modbus or asking the master.
+  Call update() after modbus_update(); a block is only rewritten
+  when its packet changed.
+
+  Layout, all fields little endian and naturally aligned:
+
+  header, 64 bytes at offset 0
+    0  u32 magic             MIRROR_MAGIC, "SMMR"
+    4  u32 version           MIRROR_VERSION
+    8  u32 block_count       one block per packet
+    12 u32 block_size        bytes per block
+    16 u32 header_size       offset of the first block
+    20 u32 writer_pid
+    24 u64 created_us        wall clock of open(), us since 1970
+    32 reserved
+
+  block n at header_size + n * block_size
+    0  u32 sequence          odd while the block is being written
+    4  u8  id, function, connection, reserved
+    8  u16 address, no_of_registers
+    12 u32 requests, successful_requests, total_errors, retries,
+           timeout, incorrect_id_returned,
+           incorrect_function_returned, incorrect_bytes_returned,
+           checksum_failed, buffer_errors, illegal_function,
+           illegal_data_address, illegal_data_value, misc_exceptions
+    68 u32 reserved
+    72 u64 updated_us        wall clock of the last change
+    80 u16 registers[125]    the first no_of_registers are valid
+    330 padding to block_size
+
+  To read a block consistently: load sequence (acquire), start
+  over while it is odd, copy the block, load sequence again and
+  start over if it changed. The sequence only grows, so a reader
+  can also tell that nothing changed since its last copy.
+*/
+
+#include "SimpleModbusMasterHost.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIRROR_MAGIC 0x524D4D53
+#define MIRROR_VERSION 1
+#define MIRROR_MAX_REGISTERS 125
+
+struct MirrorHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_count;
+    uint32_t block_size;
+    uint32_t header_size;
+    uint32_t writer_pid;
+    uint64_t created_us;
+    uint8_t reserved[32];
+};
+
+struct MirrorBlock {
+    uint32_t sequence;
+    uint8_t id;
+    uint8_t function;
+    uint8_t connection;
+    uint8_t reserved1;
+    uint16_t address;
+    uint16_t no_of_registers;
+    uint32_t requests;
+    uint32_t successful_requests;
+    uint32_t total_errors;
+    uint32_t retries;
+    uint32_t timeout;
+    uint32_t incorrect_id_returned;
+    uint32_t incorrect_function_returned;
+    uint32_t incorrect_bytes_returned;
+    uint32_t checksum_failed;
+    uint32_t buffer_errors;
+    uint32_t illegal_function;
+    uint32_t illegal_data_address;
+    uint32_t illegal_data_value;
+    uint32_t misc_exceptions;
+    uint32_t reserved2;
+    uint64_t updated_us;
+    uint16_t registers[MIRROR_MAX_REGISTERS];
+};
+
+static_assert(sizeof(MirrorHeader) == 64, "mirror header layout");
+static_assert(offsetof(MirrorBlock, requests) == 12, "mirror block layout");
+static_assert(offsetof(MirrorBlock, updated_us) == 72, "mirror block layout");
+static_assert(offsetof(MirrorBlock, registers) == 80, "mirror block layout");
+static_assert(sizeof(MirrorBlock) == 336, "mirror block layout");
+
+class PacketMirror
+{
+public:
+    PacketMirror();
+    ~PacketMirror();
+
+    // creates or truncates the file, the packets must stay valid
+    bool open(const char* path, modbus_master::Packet* packets, unsigned int totalNoOfPackets);
+    void close();
+    void update();
+
+private:
+    MirrorHeader* header;
+    size_t size;
+    modbus_master::Packet* packets;
+    unsigned int totalNoOfPackets;
+};
+
+// copies block number n out of a mapped mirror, see the reader rules above
+bool mirror_read_block(const MirrorHeader* header, unsigned int n, MirrorBlock* block);
+
+#endif
@@ -0,0 +1,190 @@
+#include "PosixSerial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t baudConstant(unsigned long baud)
+{
+    switch (baud) {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+#ifdef B500000
+    case 500000: return B500000;
+#endif
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+    default: return B0;
+    }
+}
+
+PosixSerial::PosixSerial()
+    : handle(-1), isPty(false), rxHead(0), rxTail(0), txSize(0)
+{
+    ptyName[0] = 0;
+}
+
+PosixSerial::~PosixSerial()
+{
+    close();
+}
+
+bool PosixSerial::open(const char* path)
+{
+    close();
+    handle = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    return handle >= 0;
+}
+
+const char* PosixSerial::openPty()
+{
+    close();
+    handle = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (handle < 0)
+        return 0;
+
+    const char* name = 0;
+    if (grantpt(handle) == 0 && unlockpt(handle) == 0)
+        name = ptsname(handle);
+    if (!name) {
+        close();
+        return 0;
+    }
+
+    strncpy(ptyName, name, sizeof(ptyName) - 1);
+    ptyName[sizeof(ptyName) - 1] = 0;
+    isPty = true;
+    return ptyName;
+}
+
+void PosixSerial::close()
+{
+    if (handle >= 0)
+        ::close(handle);
+    handle = -1;
+    isPty = false;
+    rxHead = rxTail = 0;
+    txSize = 0;
+}
+
+bool PosixSerial::begin(unsigned long baud)
+{
+    if (handle < 0)
+        return false;
+
+    struct termios options;
+    if (tcgetattr(handle, &options) != 0)
+        return isPty; // a pty master may refuse, the slave side settings apply
+
+    cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+
+    speed_t speed = baudConstant(baud);
+    if (speed != B0) {
+        cfsetispeed(&options, speed);
+        cfsetospeed(&options, speed);
+    }
+
+    return tcsetattr(handle, TCSANOW, &options) == 0;
+}
+
+void PosixSerial::end()
+{
+    flush();
+}
+
+// read whatever the kernel has without blocking
+bool PosixSerial::fill()
+{
+    if (handle < 0)
+        return false;
+
+    if (rxHead == rxTail)
+        rxHead = rxTail = 0;
+    if (rxTail == sizeof(rx))
+        return true;
+
+    ssize_t n = ::read(handle, rx + rxTail, sizeof(rx) - rxTail);
+    if (n > 0)
+        rxTail += n;
+    // EAGAIN means no data, EIO on a pty means the other side is closed
+    return n > 0;
+}
+
+int PosixSerial::available()
+{
+    if (rxHead == rxTail)
+        fill();
+    return rxTail - rxHead;
+}
+
+int PosixSerial::read()
+{
+    if (rxHead == rxTail && !fill())
+        return -1;
+    return rx[rxHead++];
+}
+
+int PosixSerial::peek()
+{
+    if (rxHead == rxTail && !fill())
+        return -1;
+    return rx[rxHead];
+}
+
+size_t PosixSerial::write(uint8_t c)
+{
+    if (handle < 0)
+        return 0;
+    if (txSize == sizeof(tx))
+        drain();
+    tx[txSize++] = c;
+    return 1;
+}
+
+// hand the collected bytes to the kernel, waiting while it is full
+void PosixSerial::drain()
+{
+    unsigned int sent = 0;
+    while (sent < txSize) {
+        ssize_t n = ::write(handle, tx + sent, txSize - sent);
+        if (n > 0)
+            sent += n;
+        else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pfd = { handle, POLLOUT, 0 };
+            poll(&pfd, 1, 100);
+        } else
+            break; // the line is gone, drop the frame
+    }
+    txSize = 0;
+}
+
+void PosixSerial::flush()
+{
+    if (handle < 0)
+        return;
+    drain();
+    if (!isPty)
+        tcdrain(handle); // wait for the UART to shift the bytes out
+}
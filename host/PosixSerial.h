@@ -0,0 +1,51 @@
+#ifndef POSIX_SERIAL_H
+#define POSIX_SERIAL_H
+
+#include "SerialBackend.h"
+
+/*
+  SerialBackend on a POSIX terminal device.
+
+  open() takes a serial device such as /dev/ttyUSB0 or the
+  slave side of a pseudo-terminal. openPty() creates a new
+  pseudo-terminal, keeps its master side and returns the path
+  of the slave side, which another process (or another
+  PosixSerial) can open to get a linked pair of ports.
+
+  The port is put in raw 8N1 mode at the baud rate passed to
+  begin(). Reads never block, writes are collected and handed
+  to the kernel by flush() or when the buffer fills up.
+*/
+class PosixSerial : public SerialBackend
+{
+public:
+    PosixSerial();
+    ~PosixSerial();
+
+    bool open(const char* path);
+    const char* openPty();
+    void close();
+    int fd() const { return handle; }
+
+    bool begin(unsigned long baud);
+    void end();
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    void flush();
+
+private:
+    bool fill();
+    void drain();
+
+    int handle;
+    bool isPty;
+    unsigned char rx[256];
+    unsigned int rxHead, rxTail;
+    unsigned char tx[256];
+    unsigned int txSize;
+    char ptyName[64];
+};
+
+#endif
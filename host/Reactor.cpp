@@ -0,0 +1,531 @@
+#include "Reactor.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// exception codes
+#define ILLEGAL_FUNCTION 1
+#define ILLEGAL_DATA_ADDRESS 2
+#define ILLEGAL_DATA_VALUE 3
+
+// what an epoll event is about, in the low bits of its data
+#define EVENT_LINE 0
+#define EVENT_GAP 1
+#define EVENT_TIMER 2
+#define EVENT_KINDS 3
+
+void frameTiming(long baud, unsigned char profile, unsigned char bitsPerChar,
+                 unsigned long* t1_5, unsigned long* t3_5)
+{
+    if (profile == TIMING_CUSTOM)
+        return; // *t1_5 and *t3_5 are the custom values
+    if (profile == TIMING_SPEC && baud > 19200) {
+        *t1_5 = 750;
+        *t3_5 = 1750;
+    } else {
+        unsigned long charTime15 = bitsPerChar * 1500000UL / baud; // 1T * 1.5 = T1.5
+        unsigned long charTime35 = bitsPerChar * 3500000UL / baud; // 1T * 3.5 = T3.5
+        *t1_5 = charTime15 < 0xFFFF ? charTime15 : 0xFFFF;
+        *t3_5 = charTime35 < 0xFFFF ? charTime35 : 0xFFFF;
+    }
+}
+
+unsigned int crc16(const unsigned char* frame, unsigned int length)
+{
+    unsigned int crc = 0xFFFF;
+    for (unsigned int i = 0; i < length; i++) {
+        crc ^= frame[i];
+        for (unsigned char j = 0; j < 8; j++) {
+            unsigned int flag = crc & 0x0001;
+            crc >>= 1;
+            if (flag)
+                crc ^= 0xA001;
+        }
+    }
+    return ((crc << 8) | (crc >> 8)) & 0xFFFF;
+}
+
+static void armTimer(int fd, unsigned long us)
+{
+    itimerspec spec = itimerspec();
+    spec.it_value.tv_sec = us / 1000000;
+    spec.it_value.tv_nsec = (us % 1000000) * 1000;
+    timerfd_settime(fd, 0, &spec, 0);
+}
+
+RtuPort::RtuPort()
+    : baud(0), T1_5(0), T3_5(0), bitsPerChar(10), reactor(0), slot(0), rxLength(0), overflow(false),
+      waitingOutput(false)
+{
+    gapTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+RtuPort::~RtuPort()
+{
+    close(gapTimer);
+    close(timer);
+}
+
+bool RtuPort::open(const char* path, long _baud)
+{
+    baud = _baud;
+    frameTiming(baud, TIMING_SPEC, bitsPerChar, &T1_5, &T3_5);
+    return line.open(path) && line.begin(baud);
+}
+
+const char* RtuPort::openPty(long _baud)
+{
+    baud = _baud;
+    frameTiming(baud, TIMING_SPEC, bitsPerChar, &T1_5, &T3_5);
+    const char* name = line.openPty();
+    if (name)
+        line.begin(baud);
+    return name;
+}
+
+unsigned long RtuPort::transmitTime(unsigned int bytes) const
+{
+    return bytes * bitsPerChar * 1000000UL / baud;
+}
+
+void RtuPort::configureTiming(unsigned char profile, unsigned char _bitsPerChar,
+                              unsigned int t1_5, unsigned int t3_5)
+{
+    if (!baud)
+        return; // before open(), which sets the timing itself
+    bitsPerChar = _bitsPerChar;
+    T1_5 = t1_5;
+    T3_5 = t3_5;
+    frameTiming(baud, profile, bitsPerChar, &T1_5, &T3_5);
+}
+
+void RtuPort::setTimer(unsigned long us)
+{
+    armTimer(timer, us);
+}
+
+void RtuPort::send(unsigned char* frame, unsigned int length)
+{
+    unsigned int crc = crc16(frame, length);
+    frame[length] = crc >> 8;
+    frame[length + 1] = crc & 0xFF;
+    length += 2;
+
+    bool idle = tx.empty();
+    tx.insert(tx.end(), frame, frame + length);
+    if (idle)
+        writable();
+}
+
+void RtuPort::watch(bool output)
+{
+    epoll_event event = epoll_event();
+    event.events = EPOLLIN | (output ? EPOLLOUT : 0);
+    event.data.u64 = slot * EVENT_KINDS + EVENT_LINE;
+    epoll_ctl(reactor->epoll, EPOLL_CTL_MOD, line.fd(), &event);
+}
+
+void RtuPort::writable()
+{
+    if (!tx.empty()) {
+        ssize_t n = write(line.fd(), &tx[0], tx.size());
+        if (n > 0)
+            tx.erase(tx.begin(), tx.begin() + n);
+        else if (n < 0 && errno != EAGAIN && errno != EINTR)
+            tx.clear(); // the line is gone, drop the frame
+    }
+
+    // only ask for EPOLLOUT while the kernel is full
+    if (tx.empty() == waitingOutput) {
+        waitingOutput = !tx.empty();
+        watch(waitingOutput);
+    }
+}
+
+void RtuPort::readable()
+{
+    for (;;) {
+        unsigned char buffer[RTU_FRAME_SIZE];
+        ssize_t n = read(line.fd(), buffer, sizeof(buffer));
+        if (n <= 0) {
+            // a raw tty returns 0 when it is empty, EIO when the other side of a pty closed
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+                epoll_ctl(reactor->epoll, EPOLL_CTL_DEL, line.fd(), 0);
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (rxLength == RTU_FRAME_SIZE)
+                overflow = true;
+            else
+                rx[rxLength++] = buffer[i];
+        }
+        armTimer(gapTimer, T1_5); // inter character time out
+    }
+}
+
+void RtuPort::gapExpired()
+{
+    unsigned int length = overflow ? 0 : rxLength;
+    rxLength = 0;
+    overflow = false;
+    frameReceived(rx, length);
+}
+
+RtuMaster::RtuMaster()
+    : state(IDLE), packets(0), packet(0), totalNoOfPackets(0), packetIndex(0),
+      timeout(0), polling(0), retryCount(0), ok(false)
+{
+}
+
+void RtuMaster::configure(unsigned int _timeout, unsigned int _polling, unsigned char _retryCount,
+                          modbus_master::Packet* _packets, unsigned int _totalNoOfPackets)
+{
+    timeout = _timeout;
+    polling = _polling;
+    retryCount = _retryCount;
+    packets = _packets;
+    totalNoOfPackets = _totalNoOfPackets;
+    packetIndex = 0;
+    for (unsigned int i = 0; i < totalNoOfPackets; i++)
+        packets[i].connection = 1;
+}
+
+void RtuMaster::start()
+{
+    next();
+}
+
+void RtuMaster::next()
+{
+    packet = 0;
+    for (unsigned int i = 0; i < totalNoOfPackets && !packet; i++) {
+        if (packetIndex >= totalNoOfPackets)
+            packetIndex = 0;
+        if (packets[packetIndex].connection)
+            packet = &packets[packetIndex];
+        packetIndex++;
+    }
+
+    if (!packet) { // every packet lost its connection, look again later
+        state = IDLE;
+        setTimer(polling ? polling * 1000UL : T3_5);
+        return;
+    }
+
+    packet->requests++;
+    if (packet->function == PRESET_MULTIPLE_REGISTERS && packet->no_of_registers > 123) {
+        // too long for a request, it is never sent
+        packet->buffer_errors++;
+        finish(false);
+        return;
+    }
+
+    frame[0] = packet->id;
+    frame[1] = packet->function;
+    frame[2] = packet->address >> 8;
+    frame[3] = packet->address & 0xFF;
+    frame[4] = packet->no_of_registers >> 8;
+    frame[5] = packet->no_of_registers & 0xFF;
+
+    unsigned int length = 6;
+    if (packet->function == PRESET_MULTIPLE_REGISTERS) {
+        frame[6] = packet->no_of_registers * 2;
+        length = 7;
+        for (unsigned int i = 0; i < packet->no_of_registers; i++) {
+            frame[length++] = packet->register_array[i] >> 8;
+            frame[length++] = packet->register_array[i] & 0xFF;
+        }
+    }
+    send(frame, length);
+
+    // allow a frame delay to indicate end of transmission
+    state = SENDING;
+    setTimer(transmitTime(length + 2) + T3_5);
+}
+
+void RtuMaster::timerExpired()
+{
+    switch (state) {
+    case IDLE:
+        next();
+        break;
+
+    case SENDING:
+        if (packet->id == 0) { // there will be no response on a broadcast
+            finish(true);
+        } else {
+            state = WAITING;
+            setTimer(timeout * 1000UL);
+        }
+        break;
+
+    case WAITING:
+        packet->timeout++;
+        packet->total_errors++;
+        packet->retries++;
+        done();
+        break;
+
+    case POLLING:
+        if (ok) {
+            packet->successful_requests++;
+            packet->retries = 0;
+        } else {
+            packet->total_errors++;
+            packet->retries++;
+        }
+        done();
+        break;
+    }
+}
+
+// starts the polling delay
+void RtuMaster::finish(bool _ok)
+{
+    ok = _ok;
+    state = POLLING;
+    setTimer(polling ? polling * 1000UL : 1);
+}
+
+void RtuMaster::done()
+{
+    // if the number of retries have reached the max number of retries
+    // allowable, stop requesting the specific packet
+    if (packet->retries == retryCount) {
+        packet->connection = 0;
+        packet->retries = 0;
+    }
+    next();
+}
+
+void RtuMaster::frameReceived(unsigned char* response, unsigned int length)
+{
+    // the library reads what arrived during its frame delay as the response
+    if (state != SENDING && state != WAITING)
+        return;
+
+    if (length < 5) {
+        packet->buffer_errors++;
+        finish(false);
+    } else if (response[0] != packet->id) {
+        packet->incorrect_id_returned++;
+        finish(false);
+    } else if (response[1] & 0x80) {
+        switch (response[2]) {
+        case ILLEGAL_FUNCTION:
+            packet->illegal_function++;
+            break;
+        case ILLEGAL_DATA_ADDRESS:
+            packet->illegal_data_address++;
+            break;
+        case ILLEGAL_DATA_VALUE:
+            packet->illegal_data_value++;
+            break;
+        default:
+            packet->misc_exceptions++;
+        }
+        finish(false);
+    } else if (response[1] != packet->function) {
+        packet->incorrect_function_returned++;
+        finish(false);
+    } else if (packet->function == PRESET_MULTIPLE_REGISTERS) {
+        checkF16(response, length);
+    } else {
+        checkF3(response, length);
+    }
+}
+
+void RtuMaster::checkF3(unsigned char* response, unsigned int length)
+{
+    if (response[2] != packet->no_of_registers * 2 || length != 5u + response[2]) {
+        packet->incorrect_bytes_returned++;
+        finish(false);
+        return;
+    }
+    if (crc16(response, length - 2) != (unsigned int)((response[length - 2] << 8) | response[length - 1])) {
+        packet->checksum_failed++;
+        finish(false);
+        return;
+    }
+
+    for (unsigned int i = 0; i < packet->no_of_registers; i++)
+        packet->register_array[i] = (response[3 + i * 2] << 8) | response[4 + i * 2];
+    finish(true);
+}
+
+void RtuMaster::checkF16(unsigned char* response, unsigned int length)
+{
+    if (length != 8) {
+        packet->incorrect_bytes_returned++;
+        finish(false);
+        return;
+    }
+
+    unsigned int address = (response[2] << 8) | response[3];
+    unsigned int registers = (response[4] << 8) | response[5];
+    unsigned int crc = (response[6] << 8) | response[7];
+
+    if (address == packet->address && registers == packet->no_of_registers &&
+        crc == crc16(response, 6)) {
+        finish(true);
+    } else {
+        packet->checksum_failed++;
+        finish(false);
+    }
+}
+
+RtuSlave::RtuSlave()
+    : slaveID(0), holdingRegs(0), holdingRegsSize(0), errorCount(0), broadcast(false)
+{
+}
+
+void RtuSlave::configure(unsigned char _slaveID, unsigned int* _holdingRegs,
+                         unsigned int _holdingRegsSize, bool lowLatency)
+{
+    slaveID = _slaveID;
+    holdingRegs = _holdingRegs;
+    holdingRegsSize = _holdingRegsSize;
+    errorCount = 0;
+    frameTiming(baud, lowLatency ? TIMING_FAST : TIMING_SPEC, bitsPerChar, &T1_5, &T3_5);
+}
+
+void RtuSlave::exceptionResponse(unsigned char* frame, unsigned char exception)
+{
+    errorCount++;
+    if (broadcast) // don't respond to a broadcast
+        return;
+    frame[1] |= 0x80;
+    frame[2] = exception;
+    send(frame, 3);
+}
+
+void RtuSlave::frameReceived(unsigned char* frame, unsigned int length)
+{
+    // the minimum request is 8 bytes for function 3, 6 & 16
+    if (length < 8) {
+        errorCount++;
+        return;
+    }
+
+    broadcast = frame[0] == 0;
+    if (frame[0] != slaveID && !broadcast)
+        return;
+
+    if (crc16(frame, length - 2) != (unsigned int)((frame[length - 2] << 8) | frame[length - 1])) {
+        errorCount++;
+        return;
+    }
+
+    unsigned char function = frame[1];
+    unsigned int startingAddress = (frame[2] << 8) | frame[3];
+    unsigned int count = (frame[4] << 8) | frame[5];
+
+    if (function == 3 && !broadcast) { // broadcasting is not supported for function 3
+        if (startingAddress >= holdingRegsSize)
+            exceptionResponse(frame, ILLEGAL_DATA_ADDRESS);
+        else if (count < 1 || count > 125 || startingAddress + count > holdingRegsSize)
+            exceptionResponse(frame, ILLEGAL_DATA_VALUE);
+        else {
+            frame[2] = count * 2;
+            for (unsigned int i = 0; i < count; i++) {
+                frame[3 + i * 2] = holdingRegs[startingAddress + i] >> 8;
+                frame[4 + i * 2] = holdingRegs[startingAddress + i] & 0xFF;
+            }
+            send(frame, 3 + count * 2);
+        }
+    } else if (function == 6) {
+        if (startingAddress >= holdingRegsSize)
+            exceptionResponse(frame, ILLEGAL_DATA_ADDRESS);
+        else {
+            holdingRegs[startingAddress] = count; // the value
+            if (!broadcast)
+                send(frame, 6); // an echo of the request
+        }
+    } else if (function == 16) {
+        if (frame[6] != length - 9) {
+            errorCount++; // corrupted packet
+        } else if (startingAddress >= holdingRegsSize) {
+            exceptionResponse(frame, ILLEGAL_DATA_ADDRESS);
+        } else if (count < 1 || frame[6] != count * 2 || startingAddress + count > holdingRegsSize) {
+            exceptionResponse(frame, ILLEGAL_DATA_VALUE);
+        } else {
+            for (unsigned int i = 0; i < count; i++)
+                holdingRegs[startingAddress + i] = (frame[7 + i * 2] << 8) | frame[8 + i * 2];
+            if (!broadcast)
+                send(frame, 6); // the first 6 bytes of the request
+        }
+    } else {
+        exceptionResponse(frame, ILLEGAL_FUNCTION);
+    }
+}
+
+Reactor::Reactor()
+{
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+}
+
+Reactor::~Reactor()
+{
+    close(epoll);
+}
+
+bool Reactor::add(RtuPort* port)
+{
+    port->reactor = this;
+    port->slot = ports.size();
+
+    int fds[EVENT_KINDS] = { port->line.fd(), port->gapTimer, port->timer };
+    for (unsigned int kind = 0; kind < EVENT_KINDS; kind++) {
+        epoll_event event = epoll_event();
+        event.events = EPOLLIN;
+        event.data.u64 = port->slot * EVENT_KINDS + kind;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, fds[kind], &event) < 0)
+            return false;
+    }
+
+    ports.push_back(port);
+    port->start();
+    return true;
+}
+
+void Reactor::run(unsigned long ms)
+{
+    unsigned long start = millis();
+    epoll_event events[64];
+
+    for (;;) {
+        int wait = -1;
+        if (ms) {
+            unsigned long elapsed = millis() - start;
+            if (elapsed >= ms)
+                return;
+            wait = ms - elapsed;
+        }
+
+        int n = epoll_wait(epoll, events, 64, wait);
+        for (int i = 0; i < n; i++) {
+            RtuPort* port = ports[events[i].data.u64 / EVENT_KINDS];
+            unsigned long long expirations;
+
+            switch (events[i].data.u64 % EVENT_KINDS) {
+            case EVENT_LINE:
+                if (events[i].events & EPOLLOUT)
+                    port->writable();
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    port->readable();
+                break;
+            case EVENT_GAP:
+                if (read(port->gapTimer, &expirations, sizeof(expirations)) > 0)
+                    port->gapExpired();
+                break;
+            case EVENT_TIMER:
+                if (read(port->timer, &expirations, sizeof(expirations)) > 0)
+                    port->timerExpired();
+                break;
+            }
+        }
+    }
+}
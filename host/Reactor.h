@@ -0,0 +1,175 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/*
+  Single threaded event loop for many serial ports.
+
+  The library cores keep their state in globals and wait in
+  delayMicroseconds(), so a program can run one master and one
+  slave core. A Reactor runs any number of RtuMaster and RtuSlave
+  ports on one thread instead: reads never block, epoll reports
+  which port has data and a timerfd per port measures the silence
+  after the last byte. Framing follows the libraries: a frame ends
+  after T1.5 without a byte and a master keeps the line quiet for
+  T3.5 after its request, with T1.5 and T3.5 from frameTiming(),
+  the computation of modbus_configure_timing().
+
+  RtuMaster scans an array of the master library's Packets with
+  the same counters, retries, connection and polling delay, and
+  RtuSlave answers functions 3, 6 and 16 like the slave library.
+  A failed packet is retried on its next turn in the scan: the
+  retry delay of modbus_configure_retries() and the requests of
+  modbus_request() have no counterpart here.
+
+  A typical gateway:
+
+    Reactor reactor;
+    RtuMaster line1;
+    line1.open("/dev/ttyUSB0", 19200);
+    line1.configure(1000, 200, 10, packets, TOTAL_NO_OF_PACKETS);
+    reactor.add(&line1);
+    ...
+    reactor.run(0);
+*/
+
+#include "PosixSerial.h"
+#include "SimpleModbusMasterHost.h"
+
+#include <vector>
+
+#define RTU_FRAME_SIZE 256 // the largest Modbus RTU frame
+
+class Reactor;
+
+// T1.5 and T3.5 in us as modbus_configure_timing() computes them,
+// clamped to 0xFFFF like its unsigned int; TIMING_CUSTOM leaves
+// *t1_5 and *t3_5 as they are
+void frameTiming(long baud, unsigned char profile, unsigned char bitsPerChar,
+                 unsigned long* t1_5, unsigned long* t3_5);
+
+// the libraries' CRC, Lo byte in the Hi half
+unsigned int crc16(const unsigned char* frame, unsigned int length);
+
+class RtuPort
+{
+public:
+    RtuPort();
+    virtual ~RtuPort();
+
+    bool open(const char* path, long baud);
+    const char* openPty(long baud); // see PosixSerial::openPty()
+
+    // the arguments of the libraries' modbus_configure_timing(), after
+    // open() and after an RtuSlave's configure() which sets its own
+    void configureTiming(unsigned char profile, unsigned char bitsPerChar,
+                         unsigned int t1_5, unsigned int t3_5);
+
+protected:
+    // called once the port is added to a reactor
+    virtual void start() {}
+    // a frame ended, length 0 when it didn't fit RTU_FRAME_SIZE
+    virtual void frameReceived(unsigned char* frame, unsigned int length) = 0;
+    // the time set with setTimer() has passed
+    virtual void timerExpired() {}
+
+    // sends length bytes of frame followed by their CRC
+    void send(unsigned char* frame, unsigned int length);
+    void setTimer(unsigned long us); // 0 cancels
+    unsigned long transmitTime(unsigned int bytes) const;
+
+    long baud;
+    unsigned long T1_5, T3_5;
+    unsigned char bitsPerChar;
+
+private:
+    friend class Reactor;
+
+    void readable();
+    void writable();
+    void gapExpired();
+    void watch(bool output);
+
+    Reactor* reactor;
+    unsigned int slot; // index in the reactor
+    PosixSerial line;
+    int gapTimer, timer;
+    unsigned char rx[RTU_FRAME_SIZE];
+    unsigned int rxLength;
+    bool overflow;
+    std::vector<unsigned char> tx;
+    bool waitingOutput; // EPOLLOUT is on
+};
+
+class RtuMaster : public RtuPort
+{
+public:
+    RtuMaster();
+
+    // the arguments of SimpleModbusMaster's modbus_configure()
+    void configure(unsigned int timeout, unsigned int polling, unsigned char retryCount,
+                   modbus_master::Packet* packets, unsigned int totalNoOfPackets);
+
+protected:
+    void start();
+    void frameReceived(unsigned char* frame, unsigned int length);
+    void timerExpired();
+
+private:
+    void next();
+    void finish(bool ok);
+    void done();
+    void checkF3(unsigned char* frame, unsigned int length);
+    void checkF16(unsigned char* frame, unsigned int length);
+
+    enum { IDLE, SENDING, WAITING, POLLING } state;
+    modbus_master::Packet* packets;
+    modbus_master::Packet* packet;
+    unsigned int totalNoOfPackets;
+    unsigned int packetIndex;
+    unsigned int timeout, polling;
+    unsigned char retryCount;
+    bool ok; // outcome of the transaction in its polling delay
+    unsigned char frame[RTU_FRAME_SIZE];
+};
+
+class RtuSlave : public RtuPort
+{
+public:
+    RtuSlave();
+
+    // the arguments of SimpleModbusSlave's modbus_configure()
+    void configure(unsigned char slaveID, unsigned int* holdingRegs,
+                   unsigned int holdingRegsSize, bool lowLatency);
+    unsigned int errors() const { return errorCount; }
+
+protected:
+    void frameReceived(unsigned char* frame, unsigned int length);
+
+private:
+    void exceptionResponse(unsigned char* frame, unsigned char exception);
+
+    unsigned char slaveID;
+    unsigned int* holdingRegs;
+    unsigned int holdingRegsSize;
+    unsigned int errorCount;
+    bool broadcast;
+};
+
+class Reactor
+{
+public:
+    Reactor();
+    ~Reactor();
+
+    bool add(RtuPort* port);
+    // handles events for ms milliseconds, forever with 0
+    void run(unsigned long ms);
+
+private:
+    friend class RtuPort;
+
+    int epoll;
+    std::vector<RtuPort*> ports;
+};
+
+#endif
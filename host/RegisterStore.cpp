@@ -0,0 +1,130 @@
+#include "RegisterStore.h"
+
+#include <thread>
+
+RegisterStore::~RegisterStore()
+{
+    for (size_t i = 0; i < blocks.size(); i++) {
+        delete[] blocks[i]->values;
+        delete blocks[i];
+    }
+}
+
+int RegisterStore::addBlock(unsigned char unit, unsigned int address, unsigned int count)
+{
+    Block* block = new Block;
+    block->unit = unit;
+    block->address = address;
+    block->count = count;
+    block->sequence.store(0);
+    block->values = new std::atomic<unsigned int>[count];
+    for (unsigned int i = 0; i < count; i++)
+        block->values[i].store(0);
+
+    blocks.push_back(block);
+    return blocks.size() - 1;
+}
+
+void RegisterStore::publish(int number, const unsigned int* registers)
+{
+    Block* block = blocks[number];
+    unsigned long sequence = block->sequence.load(std::memory_order_relaxed);
+
+    block->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); // the odd sequence before the values
+    for (unsigned int i = 0; i < block->count; i++)
+        block->values[i].store(registers[i], std::memory_order_relaxed);
+    block->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool RegisterStore::read(unsigned char unit, unsigned int address, unsigned int count,
+                         unsigned int* registers, unsigned long* version) const
+{
+    const Block* block = 0;
+    for (size_t i = 0; i < blocks.size() && !block; i++) {
+        const Block* candidate = blocks[i];
+        if (candidate->unit == unit && address >= candidate->address &&
+            address + count <= candidate->address + candidate->count)
+            block = candidate;
+    }
+    if (!block)
+        return false;
+
+    unsigned int offset = address - block->address;
+    for (;;) {
+        unsigned long before = block->sequence.load(std::memory_order_acquire);
+        if (before == 0)
+            return false;
+        if (before & 1) {
+            std::this_thread::yield(); // a publish is in progress
+            continue;
+        }
+
+        for (unsigned int i = 0; i < count; i++)
+            registers[i] = block->values[offset + i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire); // the values before the check
+
+        if (block->sequence.load(std::memory_order_relaxed) == before) {
+            if (version)
+                *version = before / 2;
+            return true;
+        }
+    }
+}
+
+WriteQueue::WriteQueue(unsigned int capacity)
+    : head(0)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    cells = new Cell[size];
+    mask = size - 1;
+    for (size_t i = 0; i < size; i++)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+WriteQueue::~WriteQueue()
+{
+    delete[] cells;
+}
+
+// a cell is free for the push at position p when its sequence is p,
+// and holds a write for the pop at p when its sequence is p + 1
+bool WriteQueue::push(const RegisterWrite& write)
+{
+    size_t position = tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &cells[position & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        long difference = (long)(sequence - position);
+
+        if (difference == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0) {
+            return false; // full
+        } else {
+            position = tail.load(std::memory_order_relaxed); // another producer took it
+        }
+    }
+
+    cell->write = write;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool WriteQueue::pop(RegisterWrite* write)
+{
+    Cell* cell = &cells[head & mask];
+    if (cell->sequence.load(std::memory_order_acquire) != head + 1)
+        return false;
+
+    *write = cell->write;
+    cell->sequence.store(head + mask + 1, std::memory_order_release);
+    head++;
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef REGISTER_STORE_H
+#define REGISTER_STORE_H
+
+/*
+  Register table shared between bus pollers and client servers.
+
+  A host gateway has a thread per bus polling its slaves and
+  many threads answering clients from the values read. The
+  RegisterStore holds one block per polled range (a Packet's
+  register_array after check_F3_data) and protects each with a
+  sequence lock: the poller that owns a block publishes new
+  values without ever waiting, and readers copy a block and
+  retry only if a publish overlapped the copy. Nobody takes a
+  lock, so a slow reader can't hold up a bus.
+
+  Writes travel the other way through a WriteQueue per bus, a
+  bounded lock-free queue any number of client threads push to
+  and the bus thread pops from between two transactions.
+
+  Blocks are added before the threads start and a block must
+  only be published by one thread.
+*/
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+#define WRITE_MAX_REGISTERS 123 // function 16 limit
+
+class RegisterStore
+{
+public:
+    ~RegisterStore();
+
+    // returns the block number to publish with
+    int addBlock(unsigned char unit, unsigned int address, unsigned int count);
+
+    void publish(int block, const unsigned int* registers);
+
+    // copies a range that lies inside one block, false when there is
+    // no such block or it was never published; version counts publishes
+    bool read(unsigned char unit, unsigned int address, unsigned int count,
+              unsigned int* registers, unsigned long* version = 0) const;
+
+private:
+    struct Block {
+        unsigned char unit;
+        unsigned int address;
+        unsigned int count;
+        std::atomic<unsigned long> sequence; // odd while a publish is in progress
+        std::atomic<unsigned int>* values;
+    };
+
+    std::vector<Block*> blocks;
+};
+
+struct RegisterWrite {
+    unsigned char unit;
+    unsigned int address;
+    unsigned int count;
+    unsigned int values[WRITE_MAX_REGISTERS];
+};
+
+class WriteQueue
+{
+public:
+    explicit WriteQueue(unsigned int capacity); // rounded up to a power of two
+    ~WriteQueue();
+
+    bool push(const RegisterWrite& write); // any thread, false when full
+    bool pop(RegisterWrite* write); // the bus thread, false when empty
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        RegisterWrite write;
+    };
+
+    Cell* cells;
+    size_t mask;
+    std::atomic<size_t> tail; // next push
+    char padding[64]; // keeps the producers' and the consumer's index apart
+    size_t head; // next pop
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SERIAL_BACKEND_H
+#define SERIAL_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The byte transport behind a host HardwareSerial. The calls
+// mirror the Arduino Stream API: none of them may block except
+// flush(), which returns once every written byte is on the line.
+class SerialBackend
+{
+public:
+    virtual ~SerialBackend() {}
+
+    virtual bool begin(unsigned long baud) = 0;
+    virtual void end() = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t c) = 0;
+    virtual void flush() = 0;
+};
+
+#endif
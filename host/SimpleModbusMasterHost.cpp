@@ -0,0 +1,6 @@
+#include "SimpleModbusMasterHost.h"
+
+namespace modbus_master {
+HardwareSerial Serial;
+#include "SimpleModbusMaster.cpp"
+}
@@ -0,0 +1,21 @@
+#ifndef SIMPLE_MODBUS_MASTER_HOST_H
+#define SIMPLE_MODBUS_MASTER_HOST_H
+
+/*
+  SimpleModbusMaster compiled for the host.
+
+  The library source is built unmodified inside namespace
+  modbus_master together with the Serial port it talks to,
+  so a master and a slave can live in the same program.
+  Attach a SerialBackend to modbus_master::Serial before
+  calling modbus_master::modbus_configure().
+*/
+
+#include "Arduino.h"
+
+namespace modbus_master {
+extern HardwareSerial Serial;
+#include "SimpleModbusMaster.h"
+}
+
+#endif
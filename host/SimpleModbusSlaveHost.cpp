@@ -0,0 +1,6 @@
+#include "SimpleModbusSlaveHost.h"
+
+namespace modbus_slave {
+HardwareSerial Serial;
+#include "SimpleModbusSlave.cpp"
+}
@@ -0,0 +1,21 @@
+#ifndef SIMPLE_MODBUS_SLAVE_HOST_H
+#define SIMPLE_MODBUS_SLAVE_HOST_H
+
+/*
+  SimpleModbusSlave compiled for the host.
+
+  The library source is built unmodified inside namespace
+  modbus_slave together with the Serial port it talks to,
+  so a slave and a master can live in the same program.
+  Attach a SerialBackend to modbus_slave::Serial before
+  calling modbus_slave::modbus_configure().
+*/
+
+#include "Arduino.h"
+
+namespace modbus_slave {
+extern HardwareSerial Serial;
+#include "SimpleModbusSlave.h"
+}
+
+#endif
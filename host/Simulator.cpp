@@ -0,0 +1,331 @@
+#include "Simulator.h"
+
+#include <algorithm>
+
+#include <ucontext.h>
+
+#define DEVICE_STACK_SIZE (256 * 1024)
+
+struct VirtualClock::Device {
+    VirtualClock* clock;
+    std::function<void()> loop;
+    unsigned int loopTime;
+    unsigned long long wake;
+    bool started, finished;
+    ucontext_t context;
+    std::vector<char> stack;
+};
+
+// thrown into a sleeping device to unwind its stack when the clock goes away
+struct StopDevice {
+};
+
+VirtualClock::VirtualClock()
+    : time(0), runUntil(0), running(0), stopping(false), scheduler(new ucontext_t)
+{
+}
+
+VirtualClock::~VirtualClock()
+{
+    stop();
+    for (size_t i = 0; i < devices.size(); i++)
+        delete devices[i];
+    delete (ucontext_t*)scheduler;
+}
+
+// the device that runs next: earliest wake up, lowest index on a tie
+VirtualClock::Device* VirtualClock::next()
+{
+    Device* first = 0;
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!devices[i]->finished && (!first || devices[i]->wake < first->wake))
+            first = devices[i];
+    }
+    return first;
+}
+
+void VirtualClock::sleep(unsigned long long us)
+{
+    Device* device = running;
+    if (!device) {
+        time += us; // not a device, e.g. setup code before run()
+        return;
+    }
+
+    device->wake = time + us;
+    // carry on without a switch while this device is still the next one
+    if (next() == device && device->wake < runUntil) {
+        time = device->wake;
+        return;
+    }
+
+    swapcontext(&device->context, (ucontext_t*)scheduler);
+    if (stopping)
+        throw StopDevice();
+}
+
+void VirtualClock::addDevice(std::function<void()> loop, unsigned int loopTime)
+{
+    Device* device = new Device;
+    device->clock = this;
+    device->loop = loop;
+    device->loopTime = loopTime;
+    device->wake = time;
+    device->started = device->finished = false;
+    device->stack.resize(DEVICE_STACK_SIZE);
+    devices.push_back(device);
+}
+
+static VirtualClock::Device* startingDevice; // handed from run() to deviceMain()
+
+void VirtualClock::deviceMain()
+{
+    Device* device = startingDevice;
+    try {
+        for (;;) {
+            device->loop();
+            device->clock->sleep(device->loopTime);
+        }
+    } catch (StopDevice&) {
+    }
+    device->finished = true;
+    // returning resumes uc_link, the scheduler
+}
+
+void VirtualClock::run(unsigned long long until)
+{
+    runUntil = until;
+    for (;;) {
+        Device* device = next();
+        if (!device || device->wake >= until)
+            break;
+
+        if (device->wake > time)
+            time = device->wake;
+
+        if (!device->started) {
+            device->started = true;
+            getcontext(&device->context);
+            device->context.uc_stack.ss_sp = &device->stack[0];
+            device->context.uc_stack.ss_size = device->stack.size();
+            device->context.uc_link = (ucontext_t*)scheduler;
+            makecontext(&device->context, deviceMain, 0);
+            startingDevice = device;
+        }
+
+        running = device;
+        swapcontext((ucontext_t*)scheduler, &device->context);
+        running = 0;
+    }
+    if (until > time)
+        time = until;
+}
+
+// unwind the stack of every device that is sleeping
+void VirtualClock::stop()
+{
+    stopping = true;
+    for (size_t i = 0; i < devices.size(); i++) {
+        Device* device = devices[i];
+        if (!device->started || device->finished)
+            continue;
+        running = device;
+        swapcontext((ucontext_t*)scheduler, &device->context);
+        running = 0;
+    }
+}
+
+SimPort::SimPort(SimLine* _line)
+    : line(_line), portBaud(0), open(false), rxBufferSize(64), dropped(0), txStart(0), txEnd(0)
+{
+}
+
+bool SimPort::begin(unsigned long baud)
+{
+    portBaud = baud;
+    open = true;
+    return true;
+}
+
+void SimPort::end()
+{
+    open = false;
+    pending.clear();
+    rx.clear();
+}
+
+// move the bytes that have arrived by now into the receive buffer
+void SimPort::deliver()
+{
+    unsigned long long now = line->nowNs();
+    while (!pending.empty() && pending.front().time <= now) {
+        if (rxBufferSize && rx.size() >= rxBufferSize)
+            dropped++;
+        else
+            rx.push_back(pending.front().c);
+        pending.pop_front();
+    }
+}
+
+int SimPort::available()
+{
+    deliver();
+    return rx.size();
+}
+
+int SimPort::read()
+{
+    deliver();
+    if (rx.empty())
+        return -1;
+    uint8_t c = rx.front();
+    rx.pop_front();
+    return c;
+}
+
+int SimPort::peek()
+{
+    deliver();
+    return rx.empty() ? -1 : rx.front();
+}
+
+size_t SimPort::write(uint8_t c)
+{
+    if (!open)
+        return 0;
+    line->transmit(this, c);
+    return 1;
+}
+
+void SimPort::flush()
+{
+    unsigned long long sent = (txEnd + 999) / 1000;
+    unsigned long long now = line->clock().now();
+    if (sent > now)
+        line->clock().sleep(sent - now);
+}
+
+SimLine::SimLine(VirtualClock& clock, unsigned int _bitsPerChar)
+    : virtualClock(clock), bitsPerChar(_bitsPerChar), observer(0), noise(0), byteCount(0), collisionCount(0)
+{
+}
+
+SimLine::~SimLine()
+{
+    for (size_t i = 0; i < ports.size(); i++)
+        delete ports[i];
+}
+
+SimPort* SimLine::addPort()
+{
+    ports.push_back(new SimPort(this));
+    return ports.back();
+}
+
+void SimLine::transmit(SimPort* from, uint8_t c)
+{
+    // bytes queue up behind the ones the port is still sending
+    unsigned long long start = std::max(nowNs(), from->txEnd);
+    unsigned long long end = start + (unsigned long long)bitsPerChar * 1000000000ULL / from->portBaud;
+
+    bool collided = false;
+    for (size_t i = 0; i < ports.size(); i++) {
+        SimPort* other = ports[i];
+        if (other != from && other->txEnd > start && other->txStart < end)
+            collided = true;
+    }
+    if (collided)
+        collisionCount++;
+
+    byteCount++;
+    bool noisy = noise && byteCount % noise == 0;
+
+    from->txStart = start;
+    from->txEnd = end;
+
+    for (size_t i = 0; i < ports.size(); i++) {
+        SimPort* to = ports[i];
+        if (to == from || !to->open)
+            continue;
+
+        uint8_t received = c;
+        if (collided)
+            received ^= 0xA5;
+        if (noisy)
+            received ^= 0x01;
+        if (to->portBaud != from->portBaud)
+            received = received * 151 + 17; // a framing mess, but a repeatable one
+
+        SimPort::Arrival arrival = { end, received };
+        std::deque<SimPort::Arrival>::iterator at = to->pending.end();
+        while (at != to->pending.begin() && (at - 1)->time > end)
+            --at;
+        to->pending.insert(at, arrival);
+    }
+
+    if (observer)
+        observer->onByte(from, start / 1000.0, end / 1000.0, c, collided || noisy);
+}
+
+void TransactionMeter::onByte(SimPort* from, double start, double end, uint8_t c, bool corrupted)
+{
+    (void)c;
+    (void)corrupted;
+
+    if (from == master) {
+        // a response, or a gap of a character or more, ends the request
+        if (!inRequest || inResponse || start > requestEnd + (end - start)) {
+            finish();
+            inRequest = true;
+            requestStart = start;
+        }
+        requestEnd = end;
+    } else if (inRequest) {
+        if (!inResponse) {
+            inResponse = true;
+            responseStart = start;
+        }
+        responseEnd = end;
+    }
+}
+
+void TransactionMeter::finish()
+{
+    if (inRequest) {
+        if (inResponse) {
+            turnaround.push_back(responseStart - requestEnd);
+            duration.push_back(responseEnd - requestStart);
+        } else
+            unansweredCount++;
+    }
+    inRequest = inResponse = false;
+}
+
+void TransactionMeter::clear()
+{
+    inRequest = inResponse = false;
+    requestStart = requestEnd = responseStart = responseEnd = 0;
+    turnaround.clear();
+    duration.clear();
+    unansweredCount = 0;
+}
+
+double TransactionMeter::percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    double rank = p / 100 * (samples.size() - 1);
+    size_t below = (size_t)rank;
+    if (below + 1 >= samples.size())
+        return samples.back();
+    return samples[below] + (rank - below) * (samples[below + 1] - samples[below]);
+}
+
+double TransactionMeter::mean(const std::vector<double>& samples)
+{
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+    return samples.empty() ? 0 : sum / samples.size();
+}
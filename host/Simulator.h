@@ -0,0 +1,185 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+/*
+  Deterministic bus simulation for host builds.
+
+  VirtualClock is a Clock (see Clock.h) that only moves when the
+  code under test sleeps, so the libraries run against exact and
+  repeatable timing. Each simulated board is a device with its
+  own loop() running on its own stack (a ucontext coroutine), and
+  one device runs at a time: when it sleeps (delayMicroseconds(), a Serial.flush()
+  waiting for the line, or the loopTime between two calls of its
+  loop) the device with the earliest wake up time runs next, the
+  lowest index first on a tie. So a master keeps reading a
+  response while the slave is still sending it, like on a real
+  bus, and every run gives the same result.
+
+  SimLine is a half duplex line. Every SimPort on it is a
+  SerialBackend that can be attached to a library's Serial.
+  A byte written to a port occupies the line for one character
+  time at the baud rate the port was begun with and then
+  arrives at every other port. The arrival is subject to:
+  - collisions: a byte started while another port is still
+    transmitting arrives corrupted
+  - baud rate: a port begun at another rate receives garbage
+  - noise: setNoise(n) flips a bit in every n-th byte
+  - the receive buffer: bytes arriving while it is full are
+    dropped, like the Arduino core does (64 bytes by default)
+
+  Typical use:
+
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock);
+    modbus_master::Serial.attach(line.addPort());
+    modbus_slave::Serial.attach(line.addPort());
+    ... modbus_configure() both ...
+    clock.addDevice([&] { modbus_master::modbus_update(packets); }, 20);
+    clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, 20);
+    clock.run(10000000); // 10 s
+*/
+
+#include "Clock.h"
+#include "SerialBackend.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+class VirtualClock : public Clock
+{
+public:
+    VirtualClock();
+    ~VirtualClock();
+
+    unsigned long long now() { return time; }
+    void sleep(unsigned long long us);
+
+    // loop is called over and over, loopTime us apart
+    void addDevice(std::function<void()> loop, unsigned int loopTime);
+    // run the devices until the given time
+    void run(unsigned long long until);
+
+    struct Device;
+
+private:
+    static void deviceMain();
+    Device* next();
+    void stop();
+
+    unsigned long long time;
+    unsigned long long runUntil;
+    std::vector<Device*> devices;
+    Device* running;
+    bool stopping;
+    void* scheduler; // ucontext_t of run()
+};
+
+class SimLine;
+
+class SimPort : public SerialBackend
+{
+public:
+    bool begin(unsigned long baud);
+    void end();
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    void flush();
+
+    void setRxBufferSize(unsigned int size) { rxBufferSize = size; }
+    unsigned long baud() const { return portBaud; }
+    unsigned long droppedBytes() const { return dropped; }
+
+private:
+    friend class SimLine;
+
+    struct Arrival {
+        unsigned long long time; // ns
+        uint8_t c;
+    };
+
+    explicit SimPort(SimLine* line);
+    void deliver();
+
+    SimLine* line;
+    unsigned long portBaud;
+    bool open;
+    std::deque<Arrival> pending; // on the line, sorted by arrival
+    std::deque<uint8_t> rx; // arrived and unread
+    unsigned int rxBufferSize;
+    unsigned long dropped;
+    unsigned long long txStart, txEnd; // last byte on the line, ns
+};
+
+class SimLineObserver
+{
+public:
+    virtual ~SimLineObserver() {}
+    // every byte put on the line, with its start and end time in us
+    virtual void onByte(SimPort* from, double start, double end, uint8_t c, bool corrupted) = 0;
+};
+
+class SimLine
+{
+public:
+    explicit SimLine(VirtualClock& clock, unsigned int bitsPerChar = 10);
+    ~SimLine();
+
+    SimPort* addPort();
+    void setObserver(SimLineObserver* _observer) { observer = _observer; }
+    void setNoise(unsigned long everyNthByte) { noise = everyNthByte; }
+
+    VirtualClock& clock() { return virtualClock; }
+    unsigned long long nowNs() { return virtualClock.now() * 1000; }
+    unsigned long bytes() const { return byteCount; }
+    unsigned long collisions() const { return collisionCount; }
+
+private:
+    friend class SimPort;
+    void transmit(SimPort* from, uint8_t c);
+
+    VirtualClock& virtualClock;
+    unsigned int bitsPerChar;
+    std::vector<SimPort*> ports;
+    SimLineObserver* observer;
+    unsigned long noise;
+    unsigned long byteCount, collisionCount;
+};
+
+/*
+  Splits the traffic between one master port and its slaves into
+  transactions and measures them:
+  turnaround - end of the request to the first response byte
+  duration - first request byte to the last response byte
+  Requests without a response (broadcasts, timeouts) are counted
+  as unanswered.
+*/
+class TransactionMeter : public SimLineObserver
+{
+public:
+    explicit TransactionMeter(SimPort* _master) : master(_master) { clear(); }
+
+    void onByte(SimPort* from, double start, double end, uint8_t c, bool corrupted);
+    void finish(); // close the transaction in progress
+    void clear();
+
+    const std::vector<double>& turnarounds() const { return turnaround; }
+    const std::vector<double>& durations() const { return duration; }
+    unsigned long unanswered() const { return unansweredCount; }
+
+    // p in 0..100 over a sample vector, 0 when empty
+    static double percentile(std::vector<double> samples, double p);
+    static double mean(const std::vector<double>& samples);
+
+private:
+    SimPort* master;
+    bool inRequest, inResponse;
+    double requestStart, requestEnd, responseStart, responseEnd;
+    std::vector<double> turnaround, duration;
+    unsigned long unansweredCount;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SoftwareSerial_h
+#define SoftwareSerial_h
+
+// Host builds have no pins to bit bang, a SoftwareSerial is a
+// HardwareSerial that also accepts the pin constructor.
+
+#include "Arduino.h"
+
+class SoftwareSerial : public HardwareSerial
+{
+public:
+    SoftwareSerial(uint8_t receivePin, uint8_t transmitPin, bool inverse_logic = false)
+    {
+        (void)receivePin;
+        (void)transmitPin;
+        (void)inverse_logic;
+    }
+
+    bool listen() { return true; }
+    bool isListening() { return true; }
+};
+
+#endif
@@ -0,0 +1,80 @@
+/*
+  Host version of SimpleModbusMasterExample.
+
+  Reads 9 holding registers starting at address 0 from a slave
+  on a serial device or pseudo-terminal and prints them, with
+  the packet counters and the bus time breakdown, every second.
+  With a mirror file the packet is also published there for
+  other processes (see PacketMirror.h).
+
+  usage: modbus_master_pty <device> [baud] [slave id] [mirror file]
+*/
+
+#include "PacketMirror.h"
+#include "PosixSerial.h"
+#include "SimpleModbusMasterHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace modbus_master;
+
+#define TOTAL_NO_OF_PACKETS 1
+
+Packet packets[TOTAL_NO_OF_PACKETS];
+unsigned int regs[9];
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <device> [baud] [slave id] [mirror file]\n", argv[0]);
+        return 2;
+    }
+
+    PosixSerial port;
+    if (!port.open(argv[1])) {
+        perror(argv[1]);
+        return 1;
+    }
+    long baud = argc > 2 ? atol(argv[2]) : 115200;
+
+    packets[0].id = argc > 3 ? atoi(argv[3]) : 2;
+    packets[0].function = READ_HOLDING_REGISTERS;
+    packets[0].address = 0;
+    packets[0].no_of_registers = 9;
+    packets[0].register_array = regs;
+
+    Serial.attach(&port);
+    modbus_configure(baud, 1000, 200, 10, 0, packets, TOTAL_NO_OF_PACKETS);
+
+    PacketMirror mirror;
+    if (argc > 4 && !mirror.open(argv[4], packets, TOTAL_NO_OF_PACKETS)) {
+        perror(argv[4]);
+        return 1;
+    }
+
+    unsigned long lastReport = millis();
+    for (;;) {
+        // keep retrying a slave that stopped answering
+        if (modbus_update(packets) != TOTAL_NO_OF_PACKETS)
+            packets[0].connection = 1;
+        mirror.update();
+
+        if (millis() - lastReport >= 1000) {
+            lastReport = millis();
+
+            BusStats stats;
+            modbus_bus_stats(&stats);
+
+            printf("regs");
+            for (unsigned int i = 0; i < 9; i++)
+                printf(" %u", regs[i]);
+            printf(" | requests %u ok %u errors %lu | tx %lu wait %lu rx %lu polling %lu timeout %lu idle %lu us\n",
+                   packets[0].requests, packets[0].successful_requests, packets[0].total_errors,
+                   stats.transmit, stats.turnaround, stats.receive, stats.polling, stats.timeout, stats.idle);
+            fflush(stdout);
+        }
+
+        delayMicroseconds(100); // a host has better things to do than spin
+    }
+}
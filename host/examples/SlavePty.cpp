@@ -0,0 +1,54 @@
+/*
+  Host version of SimpleModbusSlaveExample.
+
+  Serves 16 holding registers on a serial device. Without a
+  device, or with "-", a new pseudo-terminal is created and
+  its path printed so a master can be pointed at it.
+  Register 0 counts the seconds since start, the others hold
+  whatever the master writes.
+
+  usage: modbus_slave_pty [device|-] [baud] [slave id]
+*/
+
+#include "PosixSerial.h"
+#include "SimpleModbusSlaveHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace modbus_slave;
+
+#define HOLDING_REGS_SIZE 16
+
+unsigned int holdingRegs[HOLDING_REGS_SIZE];
+
+int main(int argc, char* argv[])
+{
+    PosixSerial port;
+    const char* device = argc > 1 ? argv[1] : "-";
+
+    if (strcmp(device, "-") == 0) {
+        const char* name = port.openPty();
+        if (!name) {
+            perror("openpty");
+            return 1;
+        }
+        printf("%s\n", name);
+        fflush(stdout);
+    } else if (!port.open(device)) {
+        perror(device);
+        return 1;
+    }
+    long baud = argc > 2 ? atol(argv[2]) : 115200;
+    unsigned char slaveID = argc > 3 ? atoi(argv[3]) : 2;
+
+    Serial.attach(&port);
+    modbus_configure(baud, slaveID, 0, HOLDING_REGS_SIZE, 0);
+
+    for (;;) {
+        holdingRegs[0] = millis() / 1000;
+        modbus_update(holdingRegs);
+        delayMicroseconds(100);
+    }
+}
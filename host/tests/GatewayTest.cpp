@@ -0,0 +1,332 @@
+/*
+  Checks of the read cache of modbus_tcp_gateway. The gateway
+  runs as it is, on one side of a pseudo-terminal with a slave
+  answering on the other side, and is driven over TCP in real
+  time:
+
+  usage: modbus_gateway_test <path of modbus_tcp_gateway>
+
+  Exits with 0 when every check passed and 1 with the failed
+  checks on stderr otherwise.
+*/
+
+#include "PosixSerial.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#define SLAVE_ID 2
+#define REGS_SIZE 32
+#define TTL "200" // ms, -c of the gateway
+
+#define READ_HOLDING_REGISTERS 3
+#define PRESET_MULTIPLE_REGISTERS 16
+
+static PosixSerial line; // the slave's side
+static unsigned int regs[REGS_SIZE];
+static unsigned int busReads, busWrites;
+static bool holdReplies; // requests wait until this is cleared
+static std::string request; // bytes of the request being received
+static int failures;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static unsigned long now()
+{
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+static unsigned int crc16(const std::string& frame)
+{
+    unsigned int crc = 0xFFFF;
+    for (size_t i = 0; i < frame.size(); i++) {
+        crc ^= (unsigned char)frame[i];
+        for (unsigned char j = 0; j < 8; j++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc; // Lo byte first on the line
+}
+
+static void put16(std::string& s, unsigned int value)
+{
+    s += (char)(value >> 8);
+    s += (char)(value & 0xFF);
+}
+
+static unsigned int get16(const std::string& s, size_t i)
+{
+    return ((unsigned char)s[i] << 8) | (unsigned char)s[i + 1];
+}
+
+// answers the request in request[] if it is complete
+static void answer()
+{
+    if (request.size() < 8)
+        return;
+
+    size_t length = 8;
+    if (request[1] == PRESET_MULTIPLE_REGISTERS)
+        length = 9 + (unsigned char)request[6];
+    if (request.size() < length || holdReplies)
+        return;
+
+    std::string frame = request.substr(0, length - 2);
+    unsigned int crc = crc16(frame);
+    bool intact = (unsigned char)request[length - 2] == (crc & 0xFF) &&
+                  (unsigned char)request[length - 1] == crc >> 8;
+    request.erase(0, length);
+    if (!intact || frame[0] != SLAVE_ID)
+        return;
+
+    unsigned int address = get16(frame, 2);
+    unsigned int count = get16(frame, 4);
+    if (address + count > REGS_SIZE)
+        return;
+
+    std::string response = frame.substr(0, 2);
+    if (frame[1] == READ_HOLDING_REGISTERS) {
+        busReads++;
+        response += (char)(count * 2);
+        for (unsigned int i = 0; i < count; i++)
+            put16(response, regs[address + i]);
+    } else {
+        busWrites++;
+        for (unsigned int i = 0; i < count; i++)
+            regs[address + i] = get16(frame, 7 + i * 2);
+        put16(response, address);
+        put16(response, count);
+    }
+    crc = crc16(response);
+    response += (char)(crc & 0xFF);
+    response += (char)(crc >> 8);
+    for (size_t i = 0; i < response.size(); i++)
+        line.write(response[i]);
+    line.flush();
+}
+
+// plays the slave for ms milliseconds or until done() holds
+template <typename Done>
+static bool serve(unsigned long ms, Done done)
+{
+    unsigned long start = now();
+    while (!done()) {
+        if (now() - start > ms)
+            return false;
+        pollfd fd = { line.fd(), POLLIN, 0 };
+        poll(&fd, 1, 1);
+        while (line.available())
+            request += (char)line.read();
+        answer();
+    }
+    return true;
+}
+
+static void serve(unsigned long ms)
+{
+    serve(ms, [] { return false; });
+}
+
+struct Client {
+    int fd;
+    std::string rx;
+};
+
+static bool connectTo(Client& client, int port)
+{
+    client.fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    // the gateway may not listen yet
+    for (int attempt = 0; attempt < 200; attempt++) {
+        if (connect(client.fd, (sockaddr*)&address, sizeof(address)) == 0) {
+            int on = 1;
+            setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+static void sendRead(Client& client, unsigned int transaction, unsigned int address, unsigned int count)
+{
+    std::string adu;
+    put16(adu, transaction);
+    put16(adu, 0);
+    put16(adu, 6);
+    adu += (char)SLAVE_ID;
+    adu += (char)READ_HOLDING_REGISTERS;
+    put16(adu, address);
+    put16(adu, count);
+    send(client.fd, adu.data(), adu.size(), MSG_NOSIGNAL);
+}
+
+static void sendWrite(Client& client, unsigned int transaction, unsigned int address, unsigned int value)
+{
+    std::string adu;
+    put16(adu, transaction);
+    put16(adu, 0);
+    put16(adu, 9);
+    adu += (char)SLAVE_ID;
+    adu += (char)PRESET_MULTIPLE_REGISTERS;
+    put16(adu, address);
+    put16(adu, 1);
+    adu += (char)2;
+    put16(adu, value);
+    send(client.fd, adu.data(), adu.size(), MSG_NOSIGNAL);
+}
+
+// takes a whole response off the socket, the pdu goes to pdu
+static bool received(Client& client, unsigned int transaction, std::string& pdu)
+{
+    char buffer[512];
+    ssize_t n = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n > 0)
+        client.rx.append(buffer, n);
+
+    if (client.rx.size() < 7 || client.rx.size() < 6 + get16(client.rx, 4))
+        return false;
+
+    size_t length = 6 + get16(client.rx, 4);
+    check(get16(client.rx, 0) == transaction, "the response carries the transaction of its request");
+    pdu = client.rx.substr(7, length - 7);
+    client.rx.erase(0, length);
+    return true;
+}
+
+// the registers of a read response, or none for an exception
+static std::string values(const std::string& pdu)
+{
+    std::string s;
+    if (pdu.size() < 2 || pdu[0] != READ_HOLDING_REGISTERS)
+        return s;
+    for (size_t i = 2; i + 1 < pdu.size(); i += 2) {
+        char value[8];
+        snprintf(value, sizeof(value), "%u ", get16(pdu, i));
+        s += value;
+    }
+    return s;
+}
+
+static std::string readRegisters(Client& client, unsigned int transaction, unsigned int address, unsigned int count)
+{
+    std::string pdu;
+    sendRead(client, transaction, address, count);
+    check(serve(1000, [&] { return received(client, transaction, pdu); }), "the read is answered");
+    return values(pdu);
+}
+
+// a free TCP port, for a moment at least
+static int freePort()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(fd, (sockaddr*)&address, size);
+    getsockname(fd, (sockaddr*)&address, &size);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <path of modbus_tcp_gateway>\n", argv[0]);
+        return 2;
+    }
+
+    const char* device = line.openPty();
+    if (!device) {
+        perror("openpty");
+        return 1;
+    }
+    line.begin(115200);
+
+    for (unsigned int i = 0; i < REGS_SIZE; i++)
+        regs[i] = 1000 + i;
+
+    char port[8];
+    snprintf(port, sizeof(port), "%d", freePort());
+    pid_t gateway = fork();
+    if (gateway == 0) {
+        execl(argv[1], argv[1], "-p", port, "-b", "115200", "-o", "200", "-c", TTL, device, (char*)0);
+        _exit(127);
+    }
+
+    Client a, b;
+    if (!connectTo(a, atoi(port)) || !connectTo(b, atoi(port))) {
+        fprintf(stderr, "FAILED: the gateway doesn't listen on %s\n", port);
+        kill(gateway, SIGTERM);
+        waitpid(gateway, 0, 0);
+        return 1;
+    }
+
+    // a read inside a cached range is answered from memory
+    check(readRegisters(a, 1, 0, 4) == "1000 1001 1002 1003 ", "the first read returns the registers");
+    check(readRegisters(a, 2, 1, 2) == "1001 1002 ", "the covered read returns its registers");
+    check(readRegisters(b, 3, 0, 4) == "1000 1001 1002 1003 ", "another client reads the cached range");
+    check(busReads == 1, "the covered reads don't go to the bus");
+
+    // a write drops the ranges it overlaps
+    std::string pdu;
+    sendWrite(a, 4, 1, 777);
+    check(serve(1000, [&] { return received(a, 4, pdu); }), "the write is answered");
+    check(busWrites == 1, "the write goes to the bus");
+    check(readRegisters(a, 5, 0, 4) == "1000 777 1002 1003 ", "the read after the write sees the new value");
+    check(busReads == 2, "the read after the write goes to the bus");
+
+    // the cached range expires after its TTL
+    serve(2 * atoi(TTL));
+    check(readRegisters(a, 6, 0, 4) == "1000 777 1002 1003 ", "the read after the TTL returns the registers");
+    check(busReads == 3, "the read after the TTL goes to the bus");
+
+    // a read inside the range of the read on the bus waits for its answer
+    holdReplies = true;
+    sendRead(a, 7, 10, 4);
+    check(serve(1000, [] { return request.size() >= 8; }), "the read goes to the bus");
+    sendRead(b, 8, 11, 2);
+    serve(50); // the gateway takes the second read while the first is held
+    holdReplies = false;
+    std::string pduA, pduB;
+    bool gotA = false, gotB = false;
+    check(serve(1000, [&] {
+              gotA = gotA || received(a, 7, pduA);
+              gotB = gotB || received(b, 8, pduB);
+              return gotA && gotB;
+          }),
+          "both reads are answered");
+    check(values(pduA) == "1010 1011 1012 1013 " && values(pduB) == "1011 1012 ",
+          "both reads return their registers");
+    check(busReads == 4, "the reads share one transaction on the bus");
+
+    close(a.fd);
+    close(b.fd);
+    kill(gateway, SIGTERM);
+    waitpid(gateway, 0, 0);
+    return failures ? 1 : 0;
+}
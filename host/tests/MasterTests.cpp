@@ -0,0 +1,374 @@
+/*
+  Checks of the master core's on demand queue, discovery sweep
+  and listen only mode on the simulated line, in virtual time.
+  Every case runs in its own process since the core keeps its
+  state in globals:
+
+  usage: modbus_master_tests <queue|queue_interrupted|discovery|sniff>
+
+  Exits with 0 when the case passed and 1 with the failed checks
+  on stderr otherwise.
+*/
+
+#include "Simulator.h"
+#include "SimpleModbusMasterHost.h"
+#include "SimpleModbusSlaveHost.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+using namespace modbus_master;
+
+#define BAUD 115200
+#define SLAVE_ID 1
+#define ABSENT_ID 9
+#define HOLDING_REGS_SIZE 50
+#define LOOP_TIME 50 // us between two calls of a device's loop
+
+static unsigned int holdingRegs[HOLDING_REGS_SIZE];
+static int failures;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static void setPacket(Packet* packet, unsigned char id, unsigned int address,
+                      unsigned int count, unsigned int* registers)
+{
+    packet->id = id;
+    packet->function = READ_HOLDING_REGISTERS;
+    packet->address = address;
+    packet->no_of_registers = count;
+    packet->register_array = registers;
+}
+
+static unsigned int crc16(const unsigned char* frame, unsigned int length)
+{
+    unsigned int crc = 0xFFFF;
+    for (unsigned int i = 0; i < length; i++) {
+        crc ^= frame[i];
+        for (unsigned char j = 0; j < 8; j++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc; // Lo byte first on the line
+}
+
+// writes a frame and its CRC to a raw port
+static void sendFrame(SimPort* port, unsigned char* frame, unsigned int length)
+{
+    unsigned int crc = crc16(frame, length);
+    frame[length] = crc & 0xFF;
+    frame[length + 1] = crc >> 8;
+    for (unsigned int i = 0; i < length + 2; i++)
+        port->write(frame[i]);
+    port->flush();
+}
+
+// a Stream that keeps what the sniffer writes
+class Capture : public Stream
+{
+public:
+    size_t write(uint8_t c) { text += (char)c; return 1; }
+    using Print::write;
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+
+    std::string text;
+};
+
+struct Outcome {
+    Packet* packet;
+    unsigned char ok;
+    unsigned int value; // the first register when the callback ran
+};
+
+static std::vector<Outcome> outcomes;
+
+static void requestDone(Packet* packet, unsigned char ok)
+{
+    Outcome outcome = { packet, ok, packet->register_array[0] };
+    outcomes.push_back(outcome);
+}
+
+static int countOutcomes(Packet* packet)
+{
+    int n = 0;
+    for (size_t i = 0; i < outcomes.size(); i++)
+        n += outcomes[i].packet == packet;
+    return n;
+}
+
+// queued requests racing the scan of packets[]
+static void testQueue()
+{
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock);
+    modbus_master::Serial.attach(line.addPort());
+    modbus_slave::Serial.attach(line.addPort());
+
+    unsigned int scanRegs[2][4];
+    Packet packets[2] = {};
+    setPacket(&packets[0], SLAVE_ID, 0, 4, scanRegs[0]);
+    setPacket(&packets[1], SLAVE_ID, 4, 4, scanRegs[1]);
+
+    unsigned int normalReg = 0, urgentReg = 0, absentReg = 0;
+    Packet normal = {}, urgent = {}, absent = {};
+    setPacket(&normal, SLAVE_ID, 10, 1, &normalReg);
+    setPacket(&urgent, SLAVE_ID, 20, 1, &urgentReg);
+    setPacket(&absent, ABSENT_ID, 0, 1, &absentReg);
+
+    modbus_configure(BAUD, 20, 0, 2, 0, packets, 2);
+    modbus_slave::modbus_configure(BAUD, SLAVE_ID, 0, HOLDING_REGS_SIZE, 0);
+
+    bool queued = false;
+    unsigned int scannedBefore = 0;
+    clock.addDevice([&] {
+        if (!queued && clock.now() > 100000) {
+            queued = true;
+            scannedBefore = packets[0].successful_requests;
+            check(modbus_request(&normal, requestDone, 0), "the queue takes a normal request");
+            check(modbus_request(&absent, requestDone, 0), "the queue takes a request to an absent id");
+            check(modbus_request(&urgent, requestDone, 1), "the queue takes an urgent request");
+        }
+        modbus_update(packets);
+    }, LOOP_TIME);
+    clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, LOOP_TIME);
+    clock.run(500000);
+    setClock(0);
+
+    check(outcomes.size() == 3, "every queued request ends once");
+    check(!outcomes.empty() && outcomes[0].packet == &urgent, "the urgent request goes first");
+    check(countOutcomes(&normal) == 1 && countOutcomes(&urgent) == 1 && countOutcomes(&absent) == 1,
+          "no request ends twice");
+    for (size_t i = 0; i < outcomes.size(); i++) {
+        if (outcomes[i].packet == &absent)
+            check(!outcomes[i].ok, "the request to the absent id fails");
+        else
+            check(outcomes[i].ok, "the requests to the slave succeed");
+    }
+    check(normalReg == holdingRegs[10] && urgentReg == holdingRegs[20], "the queued requests read their registers");
+    check(packets[0].successful_requests > scannedBefore + 10 && packets[1].successful_requests > 10,
+          "the scan goes on around the queued requests");
+    check(packets[0].connection && packets[1].connection, "the scanned packets keep their connection");
+}
+
+// a queued request on the line when sniffing starts is sent again afterwards
+// with all of its retries
+static void testQueueInterrupted()
+{
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock);
+    modbus_master::Serial.attach(line.addPort());
+    modbus_slave::Serial.attach(line.addPort());
+
+    unsigned int scanRegs[4];
+    Packet packets[1] = {};
+    setPacket(&packets[0], SLAVE_ID, 0, 4, scanRegs);
+
+    unsigned int queuedReg = 0;
+    Packet queued = {};
+    setPacket(&queued, ABSENT_ID, 10, 1, &queuedReg); // never answered
+
+    modbus_configure(BAUD, 100, 0, 3, 0, packets, 1);
+    modbus_slave::modbus_configure(BAUD, SLAVE_ID, 0, HOLDING_REGS_SIZE, 0);
+
+    Capture capture;
+    int phase = 0;
+    unsigned long sniffStart = 0;
+    unsigned int sentBefore = 0;
+    clock.addDevice([&] {
+        if (phase == 0 && clock.now() > 200000) {
+            modbus_request(&queued, requestDone, 0); // the scan may go first
+            phase = 1;
+        } else if (phase == 1 && queued.retries) {
+            // cut short once the request used up one of its retries
+            modbus_sniff(&capture, SNIFF_TEXT);
+            sniffStart = clock.now();
+            phase = 2;
+        } else if (phase == 2 && clock.now() - sniffStart > 50000) {
+            modbus_sniff(0, 0);
+            sentBefore = queued.requests;
+            phase = 3;
+        }
+        modbus_update(packets);
+    }, LOOP_TIME);
+    clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, LOOP_TIME);
+    clock.run(1500000);
+    setClock(0);
+
+    check(phase == 3, "sniffing starts while the request is retried");
+    check(outcomes.size() == 1 && outcomes[0].packet == &queued, "the interrupted request ends once");
+    check(!outcomes.empty() && !outcomes[0].ok, "the unanswered request fails");
+    check(queued.requests - sentBefore == 3, "the interrupted request is sent again with all of its retries");
+    check(packets[0].successful_requests > 10 && packets[0].connection, "the scan goes on after sniffing");
+}
+
+struct Found {
+    unsigned char id;
+    unsigned char exception;
+    unsigned long turnaround;
+};
+
+static std::vector<Found> found;
+
+static void discovered(unsigned char id, unsigned char exception, unsigned long turnaround)
+{
+    Found slave = { id, exception, turnaround };
+    found.push_back(slave);
+}
+
+// a slave on a raw port answering reads of its id lag us after the request
+static void fakeSlave(VirtualClock& clock, SimPort* port, unsigned char id, unsigned long lag)
+{
+    port->begin(BAUD);
+    std::vector<unsigned char> request;
+    unsigned long long lastByte = 0;
+    clock.addDevice([&clock, port, id, lag, request, lastByte]() mutable {
+        while (port->available()) {
+            request.push_back(port->read());
+            lastByte = clock.now();
+        }
+        if (request.empty() || clock.now() - lastByte < lag)
+            return;
+        if (request.size() == 8 && request[0] == id && request[1] == READ_HOLDING_REGISTERS) {
+            unsigned char response[7] = { id, READ_HOLDING_REGISTERS, 2, 0, id };
+            sendFrame(port, response, 5);
+        }
+        request.clear();
+    }, LOOP_TIME);
+}
+
+// a sweep past silent ids, a slave too slow for the probe timeout
+// and a slow but timely one
+static void testDiscovery()
+{
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock);
+    modbus_master::Serial.attach(line.addPort());
+    modbus_slave::Serial.attach(line.addPort());
+
+    unsigned int scanRegs[4];
+    Packet packets[1] = {};
+    setPacket(&packets[0], SLAVE_ID, 0, 4, scanRegs);
+
+    modbus_configure(BAUD, 1000, 0, 10, 0, packets, 1);
+    modbus_slave::modbus_configure(BAUD, 5, 0, HOLDING_REGS_SIZE, 0);
+    fakeSlave(clock, line.addPort(), 8, 30000); // past the first timeout of 8 x T3.5
+    fakeSlave(clock, line.addPort(), 9, 2000);
+
+    modbus_discover(1, 12, discovered);
+    clock.addDevice([&] { modbus_update(packets); }, LOOP_TIME);
+    clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, LOOP_TIME);
+    clock.run(1000000);
+    setClock(0);
+
+    check(!modbus_discovering(), "the sweep ends");
+    check(found.size() == 2, "only the slaves that answer in time are reported");
+    for (size_t i = 0; i < found.size(); i++) {
+        check(found[i].id == 5 || found[i].id == 9, "no silent id is reported");
+        check(found[i].exception == 0, "the answers are reported intact");
+        if (found[i].id == 9)
+            check(found[i].turnaround >= 2000 && found[i].turnaround < 2200,
+                  "the turnaround is measured from the end of the probe");
+    }
+}
+
+// a raw master talking to the slave core while the master core listens
+static void testSniff()
+{
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock);
+    SimPort* raw = line.addPort();
+    modbus_master::Serial.attach(line.addPort());
+    modbus_slave::Serial.attach(line.addPort());
+    raw->begin(BAUD);
+
+    modbus_configure(BAUD, 100, 0, 3, 0, 0, 0);
+    modbus_slave::modbus_configure(BAUD, SLAVE_ID, 0, HOLDING_REGS_SIZE, 0);
+    holdingRegs[0] = 0x1234;
+    holdingRegs[1] = 0x5678;
+
+    Capture capture;
+    modbus_sniff(&capture, SNIFF_TEXT);
+
+    int step = 0;
+    clock.addDevice([&] {
+        unsigned char frame[16];
+        switch (step++) {
+        case 0: { // a read the slave answers
+            unsigned char read[] = { SLAVE_ID, 3, 0, 0, 0, 2 };
+            memcpy(frame, read, sizeof(read));
+            sendFrame(raw, frame, sizeof(read));
+            break;
+        }
+        case 1: { // nobody answers
+            unsigned char read[] = { ABSENT_ID, 3, 0, 0, 0, 1 };
+            memcpy(frame, read, sizeof(read));
+            sendFrame(raw, frame, sizeof(read));
+            break;
+        }
+        case 2: // 2 bytes of noise where the answer would be
+            raw->write(ABSENT_ID);
+            raw->write(3);
+            raw->flush();
+            break;
+        default:
+            return;
+        }
+        delayMicroseconds(20000);
+        while (raw->available())
+            raw->read();
+    }, LOOP_TIME);
+    clock.addDevice([&] { modbus_update(0); }, LOOP_TIME);
+    clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, LOOP_TIME);
+    clock.run(100000);
+    setClock(0);
+
+    // the lines without their time stamps
+    std::vector<std::string> frames;
+    size_t start = 0;
+    for (size_t end; (end = capture.text.find('\n', start)) != std::string::npos; start = end + 1)
+        frames.push_back(capture.text.substr(start + 9, end - start - 9));
+
+    check(frames.size() == 4, "every frame is written once");
+    if (frames.size() != 4)
+        return;
+    check(frames[0] == "> 01 03 00 00 00 02 c4 0b", "the read is a request");
+    check(frames[1] == "< 01 03 04 12 34 56 78 81 07", "the answer is marked as its response");
+    check(frames[2] == "> 09 03 00 00 00 01 85 42", "the read of the absent id is a request");
+    check(frames[3] == "> 09 03 crc", "the noise is not taken for a response");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name = argc > 1 ? argv[1] : "";
+
+    for (unsigned int i = 0; i < HOLDING_REGS_SIZE; i++)
+        holdingRegs[i] = 100 + i;
+
+    if (!strcmp(name, "queue"))
+        testQueue();
+    else if (!strcmp(name, "queue_interrupted"))
+        testQueueInterrupted();
+    else if (!strcmp(name, "discovery"))
+        testDiscovery();
+    else if (!strcmp(name, "sniff"))
+        testSniff();
+    else {
+        fprintf(stderr, "usage: %s <queue|queue_interrupted|discovery|sniff>\n", argv[0]);
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
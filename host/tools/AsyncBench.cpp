@@ -0,0 +1,128 @@
+/*
+  Scheduling overhead of AsyncMaster (see AsyncMaster.h).
+
+  Runs a master and a slave on the simulated line (see
+  Simulator.h) and reads 8 registers over and over, first with
+  a loop calling MasterBus directly and then from 1, 10 ...
+  coroutines sharing the bus through AsyncMaster. The bus time
+  is virtual and the same in every run, so the CPU time per
+  transaction above the direct loop's is what suspending,
+  queueing and resuming the coroutines costs.
+
+  usage: modbus_async_bench [-t virtual seconds] [-n max tasks] [-b baud]
+*/
+
+#include "AsyncMaster.h"
+#include "Simulator.h"
+#include "SimpleModbusSlaveHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// the rest of the sketch's loop() between two calls, us
+#define LOOP_TIME 50
+
+#define SLAVE_ID 1
+#define REGISTERS 8
+#define HOLDING_REGS_SIZE 120
+
+static unsigned int holdingRegs[HOLDING_REGS_SIZE];
+
+static double cpuSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static unsigned int addressOf(unsigned int k)
+{
+    return (k * REGISTERS) % (HOLDING_REGS_SIZE - REGISTERS);
+}
+
+static Task worker(AsyncMaster& master, unsigned int n, unsigned long& transactions)
+{
+    for (unsigned int k = n;; k++) {
+        Response response = co_await master.read_holding(SLAVE_ID, addressOf(k), REGISTERS);
+        if (response.ok())
+            transactions++;
+    }
+}
+
+// tasks 0 runs the direct loop, returns the CPU us per transaction
+static double run(unsigned int tasks, unsigned long seconds, long baud)
+{
+    MasterBus bus;
+    AsyncMaster master(bus); // outlives the clock, which unwinds the coroutines' callers
+    unsigned long transactions = 0;
+    double cpu = cpuSeconds();
+    {
+        VirtualClock clock;
+        setClock(&clock);
+        SimLine line(clock);
+        modbus_master::Serial.attach(line.addPort());
+        modbus_slave::Serial.attach(line.addPort());
+        bus.configure(baud, 100);
+        modbus_slave::modbus_configure(baud, SLAVE_ID, 0, HOLDING_REGS_SIZE, 0);
+
+        unsigned int regs[REGISTERS];
+        unsigned int k = 0;
+        bool started = false;
+        clock.addDevice([&] {
+            if (tasks) {
+                if (!started) {
+                    started = true;
+                    for (unsigned int n = 0; n < tasks; n++)
+                        worker(master, n, transactions);
+                }
+                master.poll();
+            } else {
+                if (bus.busy() && bus.poll() == BUS_OK)
+                    transactions++;
+                if (!bus.busy())
+                    bus.start(SLAVE_ID, READ_HOLDING_REGISTERS, addressOf(k++), REGISTERS, regs);
+            }
+        }, LOOP_TIME);
+        clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, LOOP_TIME);
+        clock.run(seconds * 1000000ULL);
+    }
+    cpu = cpuSeconds() - cpu;
+    setClock(0);
+
+    double perTransaction = transactions ? cpu * 1e6 / transactions : 0;
+    printf("%6u %12lu %16.2f\n", tasks, transactions, perTransaction);
+    fflush(stdout);
+    return perTransaction;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long seconds = 300;
+    unsigned int maxTasks = 10000;
+    long baud = 115200;
+
+    int option;
+    while ((option = getopt(argc, argv, "t:n:b:")) != -1) {
+        switch (option) {
+        case 't': seconds = atol(optarg); break;
+        case 'n': maxTasks = atoi(optarg); break;
+        case 'b': baud = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-t virtual seconds] [-n max tasks] [-b baud]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf(" tasks transactions cpu us/transaction\n");
+    double direct = run(0, seconds, baud);
+    double worst = 0;
+    for (unsigned int tasks = 1; tasks <= maxTasks; tasks *= 10) {
+        double overhead = run(tasks, seconds, baud) - direct;
+        if (overhead > worst)
+            worst = overhead;
+    }
+    printf("coroutine overhead up to %.2f us per transaction\n", worst);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+  Throughput benchmark of SimpleModbusMaster against
+  SimpleModbusSlave on the simulated line (see Simulator.h).
+
+  Sweeps baud rates with and without the slave's low latency
+  timing, function codes 3 and 16, registers per request and
+  packets per scan, and writes one CSV row per configuration:
+  transactions and registers per second and the p50/p99 of the
+  turnaround (request end to response start) and of the whole
+  transaction, all in virtual time so the numbers are exact and
+  only change when the libraries do.
+
+  Configurations whose frames don't fit the libraries' frame
+  buffer are skipped.
+
+  usage: modbus_bench [-t seconds per run] [-o file.csv]
+*/
+
+#include "Simulator.h"
+#include "SimpleModbusMasterHost.h"
+#include "SimpleModbusSlaveHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// BUFFER_SIZE of both libraries, the host build gives them the same
+#define LIBRARY_BUFFER_SIZE MODBUS_BUFFER_SIZE
+
+// the rest of the sketch's loop() between two modbus_update() calls, us
+#define LOOP_TIME 50
+
+#define SLAVE_ID 1
+#define MAX_PACKETS 32
+#define MAX_REGISTERS 125
+// all packets work on the same first MAX_REGISTERS registers
+#define HOLDING_REGS_SIZE MAX_REGISTERS
+
+static const long bauds[] = { 9600, 19200, 38400, 57600, 115200, 230400, 500000, 1000000 };
+static const unsigned int registerCounts[] = { 1, 8, 16, 32, 61, 125 };
+static const unsigned char functions[] = { READ_HOLDING_REGISTERS, PRESET_MULTIPLE_REGISTERS };
+static const unsigned int packetCounts[] = { 1, 4, 16, 32 };
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+static unsigned int holdingRegs[HOLDING_REGS_SIZE];
+static unsigned int regs[MAX_PACKETS][MAX_REGISTERS];
+
+static bool fits(unsigned char function, unsigned int registers)
+{
+    if (function == READ_HOLDING_REGISTERS)
+        return 5 + registers * 2 <= LIBRARY_BUFFER_SIZE; // response
+    return 9 + registers * 2 <= LIBRARY_BUFFER_SIZE; // request
+}
+
+static void run(FILE* out, long baud, unsigned char lowLatency, unsigned char function,
+                unsigned int registers, unsigned int packetCount, unsigned long seconds)
+{
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock);
+    SimPort* masterPort = line.addPort();
+    SimPort* slavePort = line.addPort();
+    TransactionMeter meter(masterPort);
+    line.setObserver(&meter);
+
+    modbus_master::Packet packets[MAX_PACKETS] = {};
+    for (unsigned int i = 0; i < packetCount; i++) {
+        packets[i].id = SLAVE_ID;
+        packets[i].function = function;
+        packets[i].address = 0;
+        packets[i].no_of_registers = registers;
+        packets[i].register_array = regs[i];
+    }
+
+    modbus_master::Serial.attach(masterPort);
+    modbus_slave::Serial.attach(slavePort);
+    modbus_master::modbus_configure(baud, 100, 0, 255, 0, packets, packetCount);
+    modbus_slave::modbus_configure(baud, SLAVE_ID, 0, HOLDING_REGS_SIZE, lowLatency);
+
+    clock.addDevice([&] {
+        if (modbus_master::modbus_update(packets) != packetCount) {
+            for (unsigned int i = 0; i < packetCount; i++)
+                packets[i].connection = 1;
+        }
+    }, LOOP_TIME);
+    clock.addDevice([&] { modbus_slave::modbus_update(holdingRegs); }, LOOP_TIME);
+    clock.run(seconds * 1000000ULL);
+    meter.finish();
+
+    unsigned long successful = 0, errors = 0, timeouts = 0;
+    for (unsigned int i = 0; i < packetCount; i++) {
+        successful += packets[i].successful_requests;
+        errors += packets[i].total_errors;
+        timeouts += packets[i].timeout;
+    }
+
+    const std::vector<double>& turnaround = meter.turnarounds();
+    const std::vector<double>& duration = meter.durations();
+    fprintf(out, "%ld,%u,%u,%u,%u,%lu,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%lu,%lu\n",
+            baud, lowLatency, function, registers, packetCount, successful,
+            successful / (double)seconds, successful * registers / (double)seconds,
+            TransactionMeter::percentile(turnaround, 50), TransactionMeter::percentile(turnaround, 99),
+            TransactionMeter::percentile(duration, 50), TransactionMeter::percentile(duration, 99),
+            errors, timeouts);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long seconds = 5;
+    FILE* out = stdout;
+
+    int option;
+    while ((option = getopt(argc, argv, "t:o:")) != -1) {
+        switch (option) {
+        case 't': seconds = atol(optarg); break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (!out) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t seconds per run] [-o file.csv]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    fprintf(out, "baud,low_latency,function,registers,packets,transactions,transactions_per_s,registers_per_s,"
+                 "turnaround_p50_us,turnaround_p99_us,transaction_p50_us,transaction_p99_us,errors,timeouts\n");
+    fflush(out);
+
+    for (unsigned int b = 0; b < COUNT(bauds); b++)
+        for (unsigned char lowLatency = 0; lowLatency < 2; lowLatency++)
+            for (unsigned int f = 0; f < COUNT(functions); f++)
+                for (unsigned int r = 0; r < COUNT(registerCounts); r++)
+                    for (unsigned int p = 0; p < COUNT(packetCounts); p++) {
+                        if (!fits(functions[f], registerCounts[r]))
+                            continue;
+
+                        // the libraries keep their state in globals, every
+                        // configuration gets a fresh copy of them
+                        pid_t child = fork();
+                        if (child == 0) {
+                            run(out, bauds[b], lowLatency, functions[f], registerCounts[r], packetCounts[p], seconds);
+                            fflush(out);
+                            _exit(0);
+                        }
+                        int status;
+                        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                            fprintf(stderr, "run failed: baud %ld low latency %u function %u registers %u packets %u\n",
+                                    bauds[b], lowLatency, functions[f], registerCounts[r], packetCounts[p]);
+                            return 1;
+                        }
+                    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+  Prints the packets a master publishes with PacketMirror.
+
+  A reader of the mirror as another process would write it:
+  map the file read only and copy blocks with the sequence
+  check from PacketMirror.h. With -w the file is polled every
+  ms milliseconds and only blocks that changed are printed.
+
+  usage: modbus_mirror_dump [-w ms] <file>
+*/
+
+#include "PacketMirror.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+static void print(unsigned int n, const MirrorBlock& block)
+{
+    printf("%u: id %u function %u address %u connection %u seq %u | requests %u ok %u errors %u | regs",
+           n, block.id, block.function, block.address, block.connection, block.sequence,
+           block.requests, block.successful_requests, block.total_errors);
+    for (unsigned int i = 0; i < block.no_of_registers && i < MIRROR_MAX_REGISTERS; i++)
+        printf(" %u", block.registers[i]);
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long interval = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "w:")) != -1) {
+        switch (option) {
+        case 'w': interval = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-w ms] <file>\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-w ms] <file>\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(MirrorHeader)) {
+        perror(argv[optind]);
+        return 1;
+    }
+    void* map = mmap(0, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const MirrorHeader* header = (const MirrorHeader*)map;
+    if (header->magic != MIRROR_MAGIC || header->version != MIRROR_VERSION ||
+        header->header_size + (size_t)header->block_count * header->block_size > (size_t)status.st_size) {
+        fprintf(stderr, "%s is not a version %d packet mirror\n", argv[optind], MIRROR_VERSION);
+        return 1;
+    }
+
+    printf("writer %u, %u packets\n", header->writer_pid, header->block_count);
+    std::vector<uint32_t> seen(header->block_count, 0);
+    for (;;) {
+        MirrorBlock block;
+        for (unsigned int n = 0; n < header->block_count; n++) {
+            if (mirror_read_block(header, n, &block) && block.sequence != seen[n]) {
+                seen[n] = block.sequence;
+                print(n, block);
+            }
+        }
+        fflush(stdout);
+
+        if (!interval)
+            return 0;
+        usleep(interval * 1000);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+  Scaling benchmark of the Reactor (see Reactor.h).
+
+  For 1, 2, 4 ... ports pairs of pseudo-terminals are created,
+  an RtuMaster on one side polling an RtuSlave on the other,
+  and all of them run on one Reactor thread. Each row shows the
+  transactions per second over all ports and the CPU time the
+  thread used, in total and per transaction. Pseudo-terminals
+  don't pace bytes at the baud rate, so the bus time is only
+  the T1.5/T3.5 gaps and the CPU figures are an upper bound of
+  the per port cost on real lines.
+
+  usage: modbus_reactor_bench [-p max ports] [-t seconds] [-b baud] [-r registers]
+*/
+
+#include "Reactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using modbus_master::Packet;
+
+#define SLAVE_ID 1
+#define HOLDING_REGS_SIZE 125
+
+static double cpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static bool run(unsigned int portCount, unsigned long seconds, long baud, unsigned int registers)
+{
+    Reactor reactor;
+    RtuMaster* masters = new RtuMaster[portCount];
+    RtuSlave* slaves = new RtuSlave[portCount];
+    Packet* packets = new Packet[portCount]();
+    unsigned int* regs = new unsigned int[portCount * registers];
+    unsigned int* holdingRegs = new unsigned int[portCount * HOLDING_REGS_SIZE]();
+
+    bool ok = true;
+    for (unsigned int p = 0; p < portCount && ok; p++) {
+        const char* name = masters[p].openPty(baud);
+        ok = name && slaves[p].open(name, baud);
+        if (!ok)
+            break;
+
+        packets[p].id = SLAVE_ID;
+        packets[p].function = READ_HOLDING_REGISTERS;
+        packets[p].address = 0;
+        packets[p].no_of_registers = registers;
+        packets[p].register_array = &regs[p * registers];
+
+        slaves[p].configure(SLAVE_ID, &holdingRegs[p * HOLDING_REGS_SIZE], HOLDING_REGS_SIZE, false);
+        masters[p].configure(1000, 0, 10, &packets[p], 1);
+        ok = reactor.add(&slaves[p]) && reactor.add(&masters[p]);
+    }
+
+    if (ok) {
+        double cpu = cpuSeconds();
+        reactor.run(seconds * 1000);
+        cpu = cpuSeconds() - cpu;
+
+        unsigned long transactions = 0, errors = 0;
+        for (unsigned int p = 0; p < portCount; p++) {
+            transactions += packets[p].successful_requests;
+            errors += packets[p].total_errors;
+        }
+        printf("%5u %14.0f %12.0f %8.1f %10.1f %7lu\n", portCount,
+               transactions / (double)seconds, transactions / (double)seconds / portCount,
+               cpu * 100 / seconds, transactions ? cpu * 1e6 / transactions : 0.0, errors);
+        fflush(stdout);
+    }
+
+    delete[] masters;
+    delete[] slaves;
+    delete[] packets;
+    delete[] regs;
+    delete[] holdingRegs;
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int maxPorts = 16;
+    unsigned long seconds = 3;
+    long baud = 115200;
+    unsigned int registers = 9;
+
+    int option;
+    while ((option = getopt(argc, argv, "p:t:b:r:")) != -1) {
+        switch (option) {
+        case 'p': maxPorts = atoi(optarg); break;
+        case 't': seconds = atol(optarg); break;
+        case 'b': baud = atol(optarg); break;
+        case 'r': registers = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-p max ports] [-t seconds] [-b baud] [-r registers]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (registers < 1 || registers > HOLDING_REGS_SIZE || seconds < 1) {
+        fprintf(stderr, "registers must be 1 to %d and seconds at least 1\n", HOLDING_REGS_SIZE);
+        return 2;
+    }
+
+    printf("ports transactions/s per port/s   cpu %% cpu us/tr  errors\n");
+    for (unsigned int ports = 1; ports <= maxPorts; ports *= 2) {
+        if (!run(ports, seconds, baud, registers)) {
+            perror("pty");
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+  Runs SimpleModbusMaster against SimpleModbusSlave on a simulated
+  line in virtual time and reports the timing of the exchange.
+  The output only depends on the options, so it can be compared
+  between revisions to catch timing regressions.
+
+  usage: modbus_sim_timing [options]
+    -b baud        line speed (115200)
+    -r registers   registers read per request (9)
+    -l             configure the slave for low latency
+    -f             TIMING_FAST on both ends
+    -c bits        bits per character on the line (10)
+    -p ms          master polling delay (0)
+    -o ms          master timeout (1000)
+    -t seconds     virtual time to run (10)
+    -m             also poll a slave id that never answers
+    -n n           flip a bit in every n-th byte on the line
+    -a             let the slave find the baud rate, starting at 9600
+    -e             exit 1 when a request to the slave failed or went
+                   unanswered, with -a once it found the rate; for
+                   tests, so not together with -m
+*/
+
+#include "Simulator.h"
+#include "SimpleModbusMasterHost.h"
+#include "SimpleModbusSlaveHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// frame timing picked by each library's modbus_configure()
+namespace modbus_master {
+extern unsigned int T1_5, T3_5;
+}
+namespace modbus_slave {
+extern unsigned int T1_5, T3_5;
+}
+
+// the rest of the sketch's loop() between two modbus_update() calls, us
+#define LOOP_TIME 50
+
+#define SLAVE_ID 2
+#define MISSING_SLAVE_ID 3
+#define HOLDING_REGS_SIZE 125
+
+unsigned int holdingRegs[HOLDING_REGS_SIZE];
+unsigned int regs[HOLDING_REGS_SIZE];
+unsigned int missingRegs[1];
+
+// the slave's candidates with -a
+const long autoBauds[] = { 9600, 19200, 38400, 57600, 115200, 230400, 500000, 1000000 };
+#define AUTO_BAUDS (sizeof(autoBauds) / sizeof(autoBauds[0]))
+
+int main(int argc, char* argv[])
+{
+    long baud = 115200;
+    unsigned int registers = 9;
+    unsigned char lowLatency = 0;
+    bool fast = false;
+    unsigned char bitsPerChar = 10;
+    unsigned int polling = 0;
+    unsigned int timeout = 1000;
+    unsigned long seconds = 10;
+    bool missing = false;
+    unsigned long noise = 0;
+    bool autoBaud = false;
+    bool check = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "b:r:lfc:p:o:t:mn:ae")) != -1) {
+        switch (option) {
+        case 'b': baud = atol(optarg); break;
+        case 'r': registers = atoi(optarg); break;
+        case 'l': lowLatency = 1; break;
+        case 'f': fast = true; break;
+        case 'c': bitsPerChar = atoi(optarg); break;
+        case 'p': polling = atoi(optarg); break;
+        case 'o': timeout = atoi(optarg); break;
+        case 't': seconds = atol(optarg); break;
+        case 'm': missing = true; break;
+        case 'n': noise = atol(optarg); break;
+        case 'a': autoBaud = true; break;
+        case 'e': check = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-b baud] [-r registers] [-l] [-f] [-c bits] [-p ms] [-o ms] [-t seconds] [-m] [-n n] [-a] [-e]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (registers < 1 || registers > HOLDING_REGS_SIZE) {
+        fprintf(stderr, "registers must be 1..%d\n", HOLDING_REGS_SIZE);
+        return 2;
+    }
+
+    VirtualClock clock;
+    setClock(&clock);
+    SimLine line(clock, bitsPerChar);
+    line.setNoise(noise);
+    SimPort* masterPort = line.addPort();
+    SimPort* slavePort = line.addPort();
+    TransactionMeter meter(masterPort);
+    line.setObserver(&meter);
+
+    modbus_master::Packet packets[2] = {};
+    packets[0].id = SLAVE_ID;
+    packets[0].function = READ_HOLDING_REGISTERS;
+    packets[0].no_of_registers = registers;
+    packets[0].register_array = regs;
+    packets[1].id = MISSING_SLAVE_ID;
+    packets[1].function = READ_HOLDING_REGISTERS;
+    packets[1].no_of_registers = 1;
+    packets[1].register_array = missingRegs;
+    unsigned int packetCount = missing ? 2 : 1;
+
+    for (unsigned int i = 0; i < HOLDING_REGS_SIZE; i++)
+        holdingRegs[i] = i;
+
+    modbus_master::Serial.attach(masterPort);
+    modbus_slave::Serial.attach(slavePort);
+    modbus_master::modbus_configure(baud, timeout, polling, 255, 0, packets, packetCount);
+    modbus_slave::modbus_configure(baud, SLAVE_ID, 0, HOLDING_REGS_SIZE, lowLatency);
+    modbus_master::modbus_configure_timing(fast ? TIMING_FAST : TIMING_SPEC, bitsPerChar, 0, 0);
+    modbus_slave::modbus_configure_timing(fast || lowLatency ? TIMING_FAST : TIMING_SPEC, bitsPerChar, 0, 0);
+    if (autoBaud) {
+        // a whole master timeout and polling delay may pass between two requests
+        modbus_slave::modbus_autobaud(autoBauds, AUTO_BAUDS, timeout + polling + 100);
+    }
+    unsigned long long locked = 0;
+    unsigned long unansweredBefore = 0; // while the slave was still hunting
+    unsigned long errorsBefore = 0;
+
+    clock.addDevice([&] {
+        if (modbus_master::modbus_update(packets) != packetCount) {
+            for (unsigned int i = 0; i < packetCount; i++)
+                packets[i].connection = 1;
+        }
+    }, LOOP_TIME);
+    clock.addDevice([&] {
+        modbus_slave::modbus_update(holdingRegs);
+        if (!locked && modbus_slave::modbus_baud()) {
+            locked = clock.now();
+            unansweredBefore = meter.unanswered();
+            errorsBefore = packets[0].total_errors;
+        }
+    }, LOOP_TIME);
+    clock.run(seconds * 1000000ULL);
+    // a request cut off by the end of the run isn't unanswered for -e
+    unsigned long unanswered = meter.unanswered() - unansweredBefore;
+    meter.finish();
+
+    modbus_master::BusStats stats;
+    modbus_master::modbus_bus_stats(&stats);
+    double total = stats.transmit + stats.turnaround + stats.receive + stats.polling + stats.timeout + stats.idle;
+    const std::vector<double>& turnaround = meter.turnarounds();
+    const std::vector<double>& duration = meter.durations();
+
+    printf("baud %ld registers %u low latency %u fast %u bits %u polling %u ms timeout %u ms virtual time %lu s\n",
+           baud, registers, lowLatency, fast, bitsPerChar, polling, timeout, seconds);
+    printf("master T1.5 %u us T3.5 %u us, slave T1.5 %u us T3.5 %u us\n",
+           modbus_master::T1_5, modbus_master::T3_5, modbus_slave::T1_5, modbus_slave::T3_5);
+    if (autoBaud)
+        printf("slave found %ld baud after %.1f ms\n", modbus_slave::modbus_baud(), locked / 1000.0);
+    printf("transactions %lu (%.1f/s) unanswered %lu\n",
+           (unsigned long)duration.size(), duration.size() / (double)seconds, meter.unanswered());
+    printf("turnaround us mean %.1f p50 %.1f p99 %.1f\n", TransactionMeter::mean(turnaround),
+           TransactionMeter::percentile(turnaround, 50), TransactionMeter::percentile(turnaround, 99));
+    printf("transaction us mean %.1f p50 %.1f p99 %.1f\n", TransactionMeter::mean(duration),
+           TransactionMeter::percentile(duration, 50), TransactionMeter::percentile(duration, 99));
+    for (unsigned int i = 0; i < packetCount; i++)
+        printf("packet %u: requests %u successful %u timeouts %u errors %lu\n", i,
+               packets[i].requests, packets[i].successful_requests, packets[i].timeout, packets[i].total_errors);
+    printf("bus time %%: transmit %.1f turnaround %.1f receive %.1f polling %.1f timeout %.1f idle %.1f\n",
+           100 * stats.transmit / total, 100 * stats.turnaround / total, 100 * stats.receive / total,
+           100 * stats.polling / total, 100 * stats.timeout / total, 100 * stats.idle / total);
+    printf("line: bytes %lu collisions %lu dropped master %lu slave %lu\n",
+           line.bytes(), line.collisions(), masterPort->droppedBytes(), slavePort->droppedBytes());
+
+    setClock(0);
+    if (check) {
+        unsigned long errors = packets[0].total_errors - errorsBefore;
+        if (unanswered || errors || (autoBaud && !locked)) {
+            fprintf(stderr, "FAILED: unanswered %lu errors %lu%s\n", unanswered, errors,
+                    autoBaud && !locked ? ", the baud rate wasn't found" : "");
+            return 1;
+        }
+    }
+    return 0;
+}
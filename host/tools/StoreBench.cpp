@@ -0,0 +1,221 @@
+/*
+  Contention benchmark of the RegisterStore (see RegisterStore.h).
+
+  Poller threads, one per bus, publish a block per simulated
+  transaction (-p, 0 publishes as fast as possible) and apply the
+  writes they pop from their WriteQueue, while reader threads
+  copy random ranges and client threads push writes. The same
+  load runs against a table and queues guarded by one mutex, the
+  design the store replaces. Each row shows reads, publishes and
+  writes per second for a number of readers.
+
+  usage: modbus_store_bench [-r max readers] [-t seconds] [-p us per transaction]
+*/
+
+#include "RegisterStore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define BUSES 4
+#define BLOCKS_PER_BUS 4
+#define BLOCK_SIZE 32
+#define WRITERS 2
+#define QUEUE_SIZE 64
+
+// the table the store replaces
+class MutexStore
+{
+public:
+    int addBlock(unsigned char unit, unsigned int address, unsigned int count)
+    {
+        Block block = { unit, address, count, std::vector<unsigned int>(count) };
+        blocks.push_back(block);
+        return blocks.size() - 1;
+    }
+
+    void publish(int number, const unsigned int* registers)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        memcpy(&blocks[number].values[0], registers, blocks[number].count * sizeof(unsigned int));
+    }
+
+    bool read(unsigned char unit, unsigned int address, unsigned int count, unsigned int* registers)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < blocks.size(); i++) {
+            const Block& block = blocks[i];
+            if (block.unit == unit && address >= block.address &&
+                address + count <= block.address + block.count) {
+                memcpy(registers, &block.values[address - block.address], count * sizeof(unsigned int));
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Block {
+        unsigned char unit;
+        unsigned int address;
+        unsigned int count;
+        std::vector<unsigned int> values;
+    };
+
+    std::mutex mutex;
+    std::vector<Block> blocks;
+};
+
+class MutexQueue
+{
+public:
+    explicit MutexQueue(unsigned int _capacity) : capacity(_capacity) {}
+
+    bool push(const RegisterWrite& write)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (writes.size() == capacity)
+            return false;
+        writes.push_back(write);
+        return true;
+    }
+
+    bool pop(RegisterWrite* write)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (writes.empty())
+            return false;
+        *write = writes.front();
+        writes.pop_front();
+        return true;
+    }
+
+private:
+    unsigned int capacity;
+    std::mutex mutex;
+    std::deque<RegisterWrite> writes;
+};
+
+struct Counts {
+    std::atomic<unsigned long> reads, publishes, writes;
+};
+
+template <class Store, class Queue>
+static void run(const char* name, unsigned int readers, unsigned long seconds,
+                unsigned long transactionTime)
+{
+    Store store;
+    Queue* queues[BUSES];
+    int blocks[BUSES][BLOCKS_PER_BUS];
+    for (unsigned int bus = 0; bus < BUSES; bus++) {
+        queues[bus] = new Queue(QUEUE_SIZE);
+        for (unsigned int b = 0; b < BLOCKS_PER_BUS; b++)
+            blocks[bus][b] = store.addBlock(bus + 1, b * BLOCK_SIZE, BLOCK_SIZE);
+    }
+
+    std::atomic<bool> stop(false);
+    Counts counts;
+    counts.reads = counts.publishes = counts.writes = 0;
+    std::vector<std::thread> threads;
+
+    for (unsigned int bus = 0; bus < BUSES; bus++) {
+        threads.push_back(std::thread([&, bus]() {
+            unsigned int registers[BLOCK_SIZE] = { 0 };
+            unsigned long publishes = 0, writes = 0;
+            RegisterWrite write;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (unsigned int b = 0; b < BLOCKS_PER_BUS; b++) {
+                    registers[0]++;
+                    store.publish(blocks[bus][b], registers);
+                    publishes++;
+                    if (transactionTime)
+                        std::this_thread::sleep_for(std::chrono::microseconds(transactionTime));
+                }
+                while (queues[bus]->pop(&write))
+                    writes++;
+            }
+            counts.publishes += publishes;
+            counts.writes += writes;
+        }));
+    }
+
+    for (unsigned int r = 0; r < readers; r++) {
+        threads.push_back(std::thread([&, r]() {
+            unsigned int seed = r + 1;
+            unsigned int registers[BLOCK_SIZE];
+            unsigned long reads = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                unsigned int bus = rand_r(&seed) % BUSES;
+                unsigned int address = rand_r(&seed) % (BLOCKS_PER_BUS * BLOCK_SIZE - 8);
+                unsigned int count = 1 + rand_r(&seed) % 8;
+                if ((address % BLOCK_SIZE) + count > BLOCK_SIZE)
+                    address -= count; // keep it inside one block
+                if (store.read(bus + 1, address, count, registers))
+                    reads++;
+            }
+            counts.reads += reads;
+        }));
+    }
+
+    for (unsigned int w = 0; w < WRITERS; w++) {
+        threads.push_back(std::thread([&, w]() {
+            RegisterWrite write = RegisterWrite();
+            write.count = 1;
+            unsigned int seed = 100 + w;
+            while (!stop.load(std::memory_order_relaxed)) {
+                unsigned int bus = rand_r(&seed) % BUSES;
+                write.unit = bus + 1;
+                write.address = rand_r(&seed) % (BLOCKS_PER_BUS * BLOCK_SIZE);
+                if (!queues[bus]->push(write))
+                    std::this_thread::yield(); // the bus is behind
+            }
+        }));
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    for (unsigned int bus = 0; bus < BUSES; bus++)
+        delete queues[bus];
+
+    printf("%-9s %7u %14.0f %14.0f %12.0f\n", name, readers, counts.reads / (double)seconds,
+           counts.publishes / (double)seconds, counts.writes / (double)seconds);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int maxReaders = 8;
+    unsigned long seconds = 2;
+    unsigned long transactionTime = 100;
+
+    int option;
+    while ((option = getopt(argc, argv, "r:t:p:")) != -1) {
+        switch (option) {
+        case 'r': maxReaders = atoi(optarg); break;
+        case 't': seconds = atol(optarg); break;
+        case 'p': transactionTime = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-r max readers] [-t seconds] [-p us per transaction]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%u pollers at %lu us per transaction, %u writers, %u hardware threads\n",
+           BUSES, transactionTime, WRITERS, std::thread::hardware_concurrency());
+    printf("store     readers        reads/s    publishes/s     writes/s\n");
+    for (unsigned int readers = 1; readers <= maxReaders; readers *= 2) {
+        run<RegisterStore, WriteQueue>("lockfree", readers, seconds, transactionTime);
+        run<MutexStore, MutexQueue>("mutex", readers, seconds, transactionTime);
+    }
+    return 0;
+}
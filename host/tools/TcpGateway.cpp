@@ -0,0 +1,568 @@
+/*
+  Modbus TCP to RTU gateway.
+
+  Accepts Modbus TCP clients and forwards their requests to the
+  slaves on one serial line, one transaction at a time, through
+  the SimpleModbusMaster core (see MasterBus.h). Every client has
+  its own request queue and the bus serves the clients in turn,
+  so a client pipelining many requests can't starve the others.
+  Each response carries the MBAP transaction and unit id of the
+  request it answers.
+
+  Functions 3 and 16 are forwarded as they are, function 6 is
+  sent as a single register function 16. Anything else gets an
+  illegal function exception. The unit id is the slave id, unit 0
+  broadcasts a write. Requests larger than the library's frame
+  buffer get an illegal data value exception, a slave that
+  doesn't answer correctly a gateway target exception.
+
+  Reads can be cached. A successful read is kept for its TTL, -c
+  sets the TTL for all reads and -r unit:first-last=ms the TTL of
+  the reads that fall inside a range of one slave's registers
+  (the first rule that matches wins, a TTL of 0 doesn't cache).
+  A read inside a cached range is answered from memory and a
+  read inside the range of the read on the bus waits for its
+  answer instead of queueing another transaction. Writes drop
+  the cached ranges they overlap. Only clients with nothing
+  queued or outstanding are answered this way, so a client never
+  reads back data older than its own writes.
+
+  usage: modbus_tcp_gateway [-p port] [-b baud] [-o timeout ms]
+                            [-c ms] [-r unit:first-last=ms]... <device>
+*/
+
+#include "MasterBus.h"
+#include "PosixSerial.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#define MAX_CLIENTS 64
+#define MAX_QUEUED 32 // requests per client, more are answered busy
+#define MBAP_SIZE 7
+#define MAX_PDU 253
+#define CACHE_SIZE 256 // cached ranges
+#define MAX_TTL_RULES 32
+
+#define PRESET_SINGLE_REGISTER 6
+
+// exception codes
+#define ILLEGAL_FUNCTION 1
+#define ILLEGAL_DATA_VALUE 3
+#define SLAVE_DEVICE_BUSY 6
+#define GATEWAY_PATH_UNAVAILABLE 0x0A
+#define GATEWAY_TARGET_FAILED 0x0B
+
+struct Request {
+    unsigned int transaction;
+    unsigned char unit;
+    unsigned char function; // as the client sent it
+    unsigned int address;
+    unsigned int count;
+    std::vector<unsigned int> values; // registers to write
+};
+
+struct Client {
+    int fd; // -1 for a free slot
+    std::string rx, tx;
+    std::deque<Request> queue;
+};
+
+static Client clients[MAX_CLIENTS];
+static unsigned int nextClient; // round robin position
+
+struct Waiter {
+    int client; // -1 if the client left
+    Request request;
+};
+
+static MasterBus bus;
+static Request busRequest; // the request on the bus
+static std::vector<Waiter> busWaiters; // the requests answered by it
+static unsigned int busRegisters[BUS_MAX_READ_REGISTERS];
+
+struct CacheEntry {
+    unsigned char unit;
+    unsigned char function;
+    unsigned int address;
+    unsigned int count;
+    unsigned long expires; // millis()
+    std::vector<unsigned int> registers;
+};
+
+struct TtlRule {
+    unsigned char unit;
+    unsigned int first, last;
+    unsigned long ttl;
+};
+
+static std::vector<CacheEntry> cache;
+static TtlRule ttlRules[MAX_TTL_RULES];
+static unsigned int ttlRuleCount;
+static unsigned long defaultTtl; // ms
+
+static void put16(std::string& s, unsigned int value)
+{
+    s += (char)(value >> 8);
+    s += (char)(value & 0xFF);
+}
+
+static unsigned int get16(const std::string& s, size_t i)
+{
+    return ((unsigned char)s[i] << 8) | (unsigned char)s[i + 1];
+}
+
+static void reply(Client& client, const Request& request, const std::string& pdu)
+{
+    put16(client.tx, request.transaction);
+    put16(client.tx, 0); // protocol id
+    put16(client.tx, pdu.size() + 1);
+    client.tx += (char)request.unit;
+    client.tx += pdu;
+}
+
+static void replyException(Client& client, const Request& request, unsigned char code)
+{
+    std::string pdu;
+    pdu += (char)(request.function | 0x80);
+    pdu += (char)code;
+    reply(client, request, pdu);
+}
+
+// registers are the values read, starting at request.address
+static void replyOk(Client& client, const Request& request, const unsigned int* registers)
+{
+    std::string pdu;
+    pdu += (char)request.function;
+    if (request.function == READ_HOLDING_REGISTERS) {
+        pdu += (char)(request.count * 2);
+        for (unsigned int i = 0; i < request.count; i++)
+            put16(pdu, registers[i]);
+    } else {
+        put16(pdu, request.address);
+        put16(pdu, request.function == PRESET_SINGLE_REGISTER ? request.values[0] : request.count);
+    }
+    reply(client, request, pdu);
+}
+
+static void closeClient(int c)
+{
+    close(clients[c].fd);
+    clients[c].fd = -1;
+    clients[c].rx.clear();
+    clients[c].tx.clear();
+    clients[c].queue.clear();
+    for (size_t i = 0; i < busWaiters.size(); i++) {
+        if (busWaiters[i].client == c)
+            busWaiters[i].client = -1; // the transaction finishes, the answer goes nowhere
+    }
+}
+
+static bool covers(unsigned char unit, unsigned int address, unsigned int count,
+                   const Request& request)
+{
+    return unit == request.unit && request.address >= address &&
+           request.address + request.count <= address + count;
+}
+
+static unsigned long ttlOf(const Request& request)
+{
+    for (unsigned int i = 0; i < ttlRuleCount; i++) {
+        const TtlRule& rule = ttlRules[i];
+        if (covers(rule.unit, rule.first, rule.last - rule.first + 1, request))
+            return rule.ttl;
+    }
+    return defaultTtl;
+}
+
+static void cacheStore(const Request& request, const unsigned int* registers)
+{
+    unsigned long ttl = ttlOf(request);
+    if (!ttl)
+        return;
+
+    unsigned long now = millis();
+    for (size_t i = cache.size(); i-- > 0;) {
+        const CacheEntry& entry = cache[i];
+        // expired or superseded by the new range
+        if ((long)(entry.expires - now) <= 0 ||
+            (entry.unit == request.unit && entry.function == request.function &&
+             entry.address >= request.address &&
+             entry.address + entry.count <= request.address + request.count))
+            cache.erase(cache.begin() + i);
+    }
+    if (cache.size() >= CACHE_SIZE)
+        cache.erase(cache.begin()); // the oldest
+
+    CacheEntry entry;
+    entry.unit = request.unit;
+    entry.function = request.function;
+    entry.address = request.address;
+    entry.count = request.count;
+    entry.expires = now + ttl;
+    entry.registers.assign(registers, registers + request.count);
+    cache.push_back(entry);
+}
+
+static void cacheInvalidate(const Request& write)
+{
+    for (size_t i = cache.size(); i-- > 0;) {
+        const CacheEntry& entry = cache[i];
+        if ((write.unit == 0 || entry.unit == write.unit) && // a broadcast reaches every slave
+            entry.address < write.address + write.count && write.address < entry.address + entry.count)
+            cache.erase(cache.begin() + i);
+    }
+}
+
+// answers a read from the cache or from the read on the bus
+static bool serveRead(int c, const Request& request)
+{
+    if (request.function != READ_HOLDING_REGISTERS || !ttlOf(request))
+        return false;
+
+    unsigned long now = millis();
+    for (size_t i = 0; i < cache.size(); i++) {
+        const CacheEntry& entry = cache[i];
+        if (entry.function == request.function && (long)(entry.expires - now) > 0 &&
+            covers(entry.unit, entry.address, entry.count, request)) {
+            replyOk(clients[c], request, &entry.registers[request.address - entry.address]);
+            return true;
+        }
+    }
+
+    if (bus.busy() && busRequest.function == request.function &&
+        covers(busRequest.unit, busRequest.address, busRequest.count, request)) {
+        Waiter waiter = { c, request };
+        busWaiters.push_back(waiter);
+        return true;
+    }
+    return false;
+}
+
+// nothing queued and nothing on the bus
+static bool idle(int c)
+{
+    if (!clients[c].queue.empty())
+        return false;
+    for (size_t i = 0; i < busWaiters.size(); i++) {
+        if (busWaiters[i].client == c)
+            return false;
+    }
+    return true;
+}
+
+// returns false when the request is answered right away
+static bool parse(Client& client, Request& request, const std::string& pdu)
+{
+    request.function = pdu[0];
+    if (pdu.size() >= 5) {
+        request.address = get16(pdu, 1);
+        request.count = get16(pdu, 3);
+    }
+
+    switch (request.function) {
+    case READ_HOLDING_REGISTERS:
+        if (pdu.size() != 5 || request.count < 1 || request.count > BUS_MAX_READ_REGISTERS) {
+            replyException(client, request, ILLEGAL_DATA_VALUE);
+            return false;
+        }
+        if (request.unit == 0) { // nobody answers a broadcast
+            replyException(client, request, GATEWAY_PATH_UNAVAILABLE);
+            return false;
+        }
+        return true;
+
+    case PRESET_SINGLE_REGISTER:
+        if (pdu.size() != 5) {
+            replyException(client, request, ILLEGAL_DATA_VALUE);
+            return false;
+        }
+        request.values.assign(1, request.count);
+        request.count = 1;
+        return true;
+
+    case PRESET_MULTIPLE_REGISTERS:
+        if (pdu.size() < 6 || request.count < 1 || request.count > BUS_MAX_WRITE_REGISTERS ||
+            (unsigned char)pdu[5] != request.count * 2 || pdu.size() != 6 + request.count * 2) {
+            replyException(client, request, ILLEGAL_DATA_VALUE);
+            return false;
+        }
+        request.values.resize(request.count);
+        for (unsigned int i = 0; i < request.count; i++)
+            request.values[i] = get16(pdu, 6 + i * 2);
+        return true;
+    }
+
+    replyException(client, request, ILLEGAL_FUNCTION);
+    return false;
+}
+
+// splits the received bytes into requests, returns false on a framing error
+static bool receive(int c)
+{
+    Client& client = clients[c];
+
+    while (client.rx.size() >= MBAP_SIZE) {
+        unsigned int length = get16(client.rx, 4); // unit id and pdu
+        if (get16(client.rx, 2) != 0 || length < 2 || length > MAX_PDU + 1)
+            return false;
+        if (client.rx.size() < 6 + length)
+            break;
+
+        Request request;
+        request.transaction = get16(client.rx, 0);
+        request.unit = client.rx[6];
+        std::string pdu = client.rx.substr(MBAP_SIZE, length - 1);
+        client.rx.erase(0, 6 + length);
+
+        if (!parse(client, request, pdu) || (idle(c) && serveRead(c, request)))
+            continue;
+        if (client.queue.size() >= MAX_QUEUED)
+            replyException(client, request, SLAVE_DEVICE_BUSY);
+        else
+            client.queue.push_back(request);
+    }
+    return true;
+}
+
+// returns false when there is nothing to do
+static bool startNext()
+{
+    for (unsigned int i = 0; i < MAX_CLIENTS; i++) {
+        unsigned int c = (nextClient + i) % MAX_CLIENTS;
+        if (clients[c].fd < 0 || clients[c].queue.empty())
+            continue;
+
+        busRequest = clients[c].queue.front();
+        clients[c].queue.pop_front();
+        nextClient = c + 1;
+
+        // an earlier read may have filled the cache meanwhile
+        if (serveRead(c, busRequest))
+            return true;
+
+        Waiter waiter = { (int)c, busRequest };
+        busWaiters.assign(1, waiter);
+
+        if (busRequest.function == READ_HOLDING_REGISTERS) {
+            bus.start(busRequest.unit, READ_HOLDING_REGISTERS, busRequest.address,
+                      busRequest.count, busRegisters);
+        } else {
+            for (unsigned int r = 0; r < busRequest.count; r++)
+                busRegisters[r] = busRequest.values[r];
+            bus.start(busRequest.unit, PRESET_MULTIPLE_REGISTERS, busRequest.address,
+                      busRequest.count, busRegisters);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void finish(int result)
+{
+    if (busRequest.function == READ_HOLDING_REGISTERS) {
+        if (result == BUS_OK)
+            cacheStore(busRequest, busRegisters);
+    } else {
+        cacheInvalidate(busRequest); // even a failed write may have changed something
+    }
+
+    for (size_t i = 0; i < busWaiters.size(); i++) {
+        const Waiter& waiter = busWaiters[i];
+        if (waiter.client < 0)
+            continue;
+
+        Client& client = clients[waiter.client];
+        if (result == BUS_OK)
+            replyOk(client, waiter.request, &busRegisters[waiter.request.address - busRequest.address]);
+        else if (result == BUS_EXCEPTION)
+            replyException(client, waiter.request, bus.exception());
+        else
+            replyException(client, waiter.request, GATEWAY_TARGET_FAILED);
+    }
+    busWaiters.clear();
+}
+
+static int listenOn(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static void acceptClient(int listener)
+{
+    int fd = accept(listener, 0, 0);
+    if (fd < 0)
+        return;
+
+    for (unsigned int c = 0; c < MAX_CLIENTS; c++) {
+        if (clients[c].fd < 0) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            clients[c].fd = fd;
+            return;
+        }
+    }
+    close(fd); // full
+}
+
+static void serviceClient(int c, short events)
+{
+    Client& client = clients[c];
+
+    if (events & (POLLIN | POLLHUP | POLLERR)) {
+        char buffer[512];
+        ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            closeClient(c);
+            return;
+        }
+        if (n > 0) {
+            client.rx.append(buffer, n);
+            if (!receive(c)) {
+                closeClient(c);
+                return;
+            }
+        }
+    }
+
+    if (!client.tx.empty()) {
+        ssize_t n = send(client.fd, client.tx.data(), client.tx.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            closeClient(c);
+            return;
+        }
+        if (n > 0)
+            client.tx.erase(0, n);
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-p port] [-b baud] [-o timeout ms] [-c ms] [-r unit:first-last=ms]... <device>\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    int port = 502;
+    long baud = 115200;
+    unsigned int timeout = 1000;
+
+    int option;
+    while ((option = getopt(argc, argv, "p:b:o:c:r:")) != -1) {
+        switch (option) {
+        case 'p': port = atoi(optarg); break;
+        case 'b': baud = atol(optarg); break;
+        case 'o': timeout = atoi(optarg); break;
+        case 'c': defaultTtl = atol(optarg); break;
+        case 'r': {
+            unsigned int unit, first, last;
+            unsigned long ttl;
+            if (ttlRuleCount == MAX_TTL_RULES ||
+                sscanf(optarg, "%u:%u-%u=%lu", &unit, &first, &last, &ttl) != 4 || last < first) {
+                fprintf(stderr, "bad TTL rule %s\n", optarg);
+                return 2;
+            }
+            TtlRule rule = { (unsigned char)unit, first, last, ttl };
+            ttlRules[ttlRuleCount++] = rule;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    PosixSerial serial;
+    if (!serial.open(argv[optind])) {
+        perror(argv[optind]);
+        return 1;
+    }
+    modbus_master::Serial.attach(&serial);
+    bus.configure(baud, timeout);
+
+    int listener = listenOn(port);
+    if (listener < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    for (unsigned int c = 0; c < MAX_CLIENTS; c++)
+        clients[c].fd = -1;
+
+    pollfd fds[MAX_CLIENTS + 2];
+    int fdClient[MAX_CLIENTS + 2];
+
+    for (;;) {
+        while (!bus.busy() && startNext())
+            ;
+
+        nfds_t n = 0;
+        fds[n].fd = listener;
+        fds[n].events = POLLIN;
+        fdClient[n++] = -1;
+        if (bus.busy()) { // wake up as soon as the response starts
+            fds[n].fd = serial.fd();
+            fds[n].events = POLLIN;
+            fdClient[n++] = -1;
+        }
+        for (unsigned int c = 0; c < MAX_CLIENTS; c++) {
+            if (clients[c].fd < 0)
+                continue;
+            fds[n].fd = clients[c].fd;
+            fds[n].events = POLLIN | (clients[c].tx.empty() ? 0 : POLLOUT);
+            fdClient[n++] = c;
+        }
+
+        // the library measures its timeouts itself, keep calling it
+        if (poll(fds, n, bus.busy() ? 1 : -1) < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+
+        if (bus.busy()) {
+            int result = bus.poll();
+            if (result != BUS_PENDING)
+                finish(result);
+        }
+
+        if (fds[0].revents & POLLIN)
+            acceptClient(listener);
+        for (nfds_t i = 1; i < n; i++) {
+            if (fdClient[i] >= 0 && clients[fdClient[i]].fd >= 0)
+                serviceClient(fdClient[i], fds[i].revents);
+        }
+    }
+}